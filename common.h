@@ -30,6 +30,15 @@
 
 #include "target/defs.h"
 
+/**
+ * @brief memcpy for small fixed-size copies, still inlined with -fno-builtin
+ */
+#ifdef __GNUC__
+#define INLINE_MEMCPY __builtin_memcpy
+#else
+#define INLINE_MEMCPY memcpy
+#endif
+
 #if !defined(METADATA_BUILD) && !defined(__INTELLISENSE__)
 /**
  * we're building the actual game target
@@ -0,0 +1,116 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * minimal JSON reader shared by the host tools (metadata, kb-diff, kb-import).
+ * it only covers what the tools read back: arrays of objects, strings, integers.
+ * strings are returned as views into the input buffer (escapes are kept as-is)
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <string_view>
+
+struct json_reader {
+	const char *p;
+	const char *end;
+	/** position of the first error, if any */
+	const char *error;
+};
+
+static inline void json_ws(json_reader *r){
+	while(r->p < r->end && (*r->p == ' ' || *r->p == '\n' || *r->p == '\r' || *r->p == '\t')){
+		++r->p;
+	}
+}
+
+static inline bool json_expect(json_reader *r, char c){
+	json_ws(r);
+	if(r->p >= r->end || *r->p != c){
+		r->error = r->p;
+		return false;
+	}
+	++r->p;
+	return true;
+}
+
+static inline bool json_peek(json_reader *r, char c){
+	json_ws(r);
+	return r->p < r->end && *r->p == c;
+}
+
+static inline bool json_string(json_reader *r, std::string_view *out){
+	if(!json_expect(r, '"')) return false;
+	const char *begin = r->p;
+	while(r->p < r->end && *r->p != '"'){
+		if(*r->p == '\\') ++r->p;
+		++r->p;
+	}
+	if(r->p >= r->end){
+		r->error = begin;
+		return false;
+	}
+	*out = std::string_view(begin, r->p - begin);
+	++r->p;
+	return true;
+}
+
+/** decimal integer, optionally negative */
+static inline bool json_number(json_reader *r, long *out){
+	json_ws(r);
+	const char *p = r->p;
+	bool negative = p < r->end && *p == '-';
+	if(negative) ++p;
+	if(p >= r->end || *p < '0' || *p > '9'){
+		r->error = r->p;
+		return false;
+	}
+	long v = 0;
+	for(; p < r->end && *p >= '0' && *p <= '9'; p++) v = v * 10 + (*p - '0');
+	*out = (negative) ? -v : v;
+	r->p = p;
+	return true;
+}
+
+/** string, number, true, false or null (nested values are not supported) */
+static inline bool json_scalar(json_reader *r, std::string_view *out){
+	if(json_peek(r, '"')) return json_string(r, out);
+	const char *begin = r->p;
+	while(r->p < r->end && !strchr(",]} \t\r\n", *r->p)) ++r->p;
+	if(r->p == begin){
+		r->error = r->p;
+		return false;
+	}
+	*out = std::string_view(begin, r->p - begin);
+	if(*out == "null") *out = std::string_view();
+	return true;
+}
+
+/**
+ * @brief skips any value we don't know about
+ */
+static inline bool json_skip(json_reader *r){
+	json_ws(r);
+	if(r->p >= r->end) return false;
+	char c = *r->p;
+	if(c == '{' || c == '['){
+		char close = (c == '{') ? '}' : ']';
+		++r->p;
+		if(json_peek(r, close)){
+			++r->p;
+			return true;
+		}
+		do {
+			if(c == '{'){
+				std::string_view key;
+				if(!json_string(r, &key) || !json_expect(r, ':')) return false;
+			}
+			if(!json_skip(r)) return false;
+		} while(json_peek(r, ',') && ++r->p);
+		return json_expect(r, close);
+	}
+	std::string_view dummy;
+	return json_scalar(r, &dummy);
+}
@@ -0,0 +1,429 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * structural diff between two knowledge bases (kb.json)
+ * items are matched by name with hash joins, so that the cost is linear
+ * in the number of items
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "json_reader.h"
+
+enum kb_item_type {
+	KB_FUNCTION = 0,
+	KB_DATA,
+	KB_STRUCT,
+	KB_NUM_TYPES
+};
+
+static const char *kb_type_names[KB_NUM_TYPES] = {
+	"function", "data", "struct"
+};
+
+struct kb_field {
+	std::string_view name;
+	std::string_view type;
+	long offset = 0;
+	long size = 0;
+};
+
+struct kb_item {
+	enum kb_item_type item_type = KB_NUM_TYPES;
+	std::string_view name;
+	std::string_view addr;
+	// function
+	std::string_view ret;
+	std::string_view args;
+	std::string_view regs;
+	long stack_bytes = -1;
+	// data
+	std::string_view type;
+	// struct
+	long size = 0;
+	std::vector<kb_field> fields;
+};
+
+struct kb {
+	std::string buffer;
+	std::vector<kb_item> items;
+	std::unordered_map<std::string_view, const kb_item *> index[KB_NUM_TYPES];
+};
+
+/**
+ * @brief
+ * kb.json, as emitted by metadata.cpp, is an array of flat objects,
+ * where structs carry an array of field objects
+ */
+static bool json_field(json_reader *r, kb_field *f){
+	if(!json_expect(r, '{')) return false;
+	if(json_peek(r, '}')){
+		++r->p;
+		return true;
+	}
+	do {
+		std::string_view key;
+		if(!json_string(r, &key) || !json_expect(r, ':')) return false;
+		bool ok;
+		if(key == "name") ok = json_string(r, &f->name);
+		else if(key == "type") ok = json_string(r, &f->type);
+		else if(key == "offset") ok = json_number(r, &f->offset);
+		else if(key == "size") ok = json_number(r, &f->size);
+		else ok = json_skip(r);
+		if(!ok) return false;
+	} while(json_peek(r, ',') && ++r->p);
+	return json_expect(r, '}');
+}
+
+static bool json_item(json_reader *r, kb_item *item){
+	if(!json_expect(r, '{')) return false;
+	if(json_peek(r, '}')){
+		++r->p;
+		return true;
+	}
+	do {
+		std::string_view key;
+		if(!json_string(r, &key) || !json_expect(r, ':')) return false;
+		bool ok = true;
+		if(key == "item_type"){
+			std::string_view type;
+			ok = json_string(r, &type);
+			for(int i=0; i<KB_NUM_TYPES; i++){
+				if(type == kb_type_names[i]){
+					item->item_type = (enum kb_item_type)i;
+				}
+			}
+		}
+		else if(key == "name") ok = json_string(r, &item->name);
+		else if(key == "addr") ok = json_string(r, &item->addr);
+		else if(key == "ret") ok = json_string(r, &item->ret);
+		else if(key == "args") ok = json_string(r, &item->args);
+		else if(key == "regs") ok = json_string(r, &item->regs);
+		else if(key == "type") ok = json_string(r, &item->type);
+		else if(key == "stack_bytes") ok = json_number(r, &item->stack_bytes);
+		else if(key == "size") ok = json_number(r, &item->size);
+		else if(key == "fields"){
+			if(!json_expect(r, '[')) return false;
+			if(json_peek(r, ']')){
+				++r->p;
+				continue;
+			}
+			do {
+				item->fields.emplace_back();
+				if(!json_field(r, &item->fields.back())) return false;
+			} while(json_peek(r, ',') && ++r->p);
+			ok = json_expect(r, ']');
+		}
+		else ok = json_skip(r);
+		if(!ok) return false;
+	} while(json_peek(r, ',') && ++r->p);
+	return json_expect(r, '}');
+}
+
+static bool kb_load(kb *kb, const char *filename){
+	FILE *fh = fopen(filename, "rb");
+	if(!fh){
+		fprintf(stderr, "Failed to open file '%s' for reading\n", filename);
+		return false;
+	}
+	fseek(fh, 0, SEEK_END);
+	long length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+	kb->buffer.resize(length);
+	if(length > 0 && fread(&kb->buffer[0], length, 1, fh) != 1){
+		fprintf(stderr, "Failed to read '%s'\n", filename);
+		fclose(fh);
+		return false;
+	}
+	fclose(fh);
+
+	json_reader r = { kb->buffer.data(), kb->buffer.data() + kb->buffer.size(), NULL };
+	bool ok = json_expect(&r, '[');
+	if(ok && json_peek(&r, ']')){
+		return true;
+	}
+	// rough estimate, avoids most of the reallocations
+	kb->items.reserve(length / 128);
+	while(ok){
+		kb->items.emplace_back();
+		ok = json_item(&r, &kb->items.back());
+		if(!ok || !json_peek(&r, ',')) break;
+		++r.p;
+	}
+	if(ok) ok = json_expect(&r, ']');
+	if(!ok){
+		fprintf(stderr, "%s: parse error at offset %zu\n",
+			filename, (size_t)((r.error ? r.error : r.p) - kb->buffer.data()));
+		return false;
+	}
+
+	for(int i=0; i<KB_NUM_TYPES; i++){
+		kb->index[i].reserve(kb->items.size());
+	}
+	for(const kb_item &item : kb->items){
+		if(item.item_type == KB_NUM_TYPES || item.name.empty()) continue;
+		kb->index[item.item_type][item.name] = &item;
+	}
+	return true;
+}
+
+static bool gen_json = false;
+static bool json_first = true;
+static unsigned num_changes = 0;
+
+#define SV(s) (int)(s).size(), (s).data()
+
+static void out_begin(char marker, const kb_item *item){
+	++num_changes;
+	if(gen_json){
+		printf("%s\n{\n"
+			"  \"change\": \"%s\",\n"
+			"  \"item_type\": \"%s\",\n"
+			"  \"name\": \"%.*s\"",
+			(json_first) ? "" : ",",
+			(marker == '+') ? "added" : (marker == '-') ? "removed" : "changed",
+			kb_type_names[item->item_type], SV(item->name));
+		json_first = false;
+	} else {
+		printf("%c %s %.*s\n", marker, kb_type_names[item->item_type], SV(item->name));
+	}
+}
+
+static void out_end(){
+	if(gen_json){
+		printf("\n}");
+	}
+}
+
+static void out_property(const char *key, std::string_view a, std::string_view b){
+	if(gen_json){
+		printf(",\n  \"%s\": [\"%.*s\", \"%.*s\"]", key, SV(a), SV(b));
+	} else {
+		printf("    %s: \"%.*s\" -> \"%.*s\"\n", key, SV(a), SV(b));
+	}
+}
+
+static void out_number(const char *key, long a, long b){
+	if(gen_json){
+		printf(",\n  \"%s\": [%ld, %ld]", key, a, b);
+	} else {
+		printf("    %s: %ld -> %ld\n", key, a, b);
+	}
+}
+
+static void diff_scalar(const kb_item *a, const kb_item *b){
+	bool changed = a->addr != b->addr
+		|| a->ret != b->ret || a->args != b->args
+		|| a->regs != b->regs || a->stack_bytes != b->stack_bytes
+		|| a->type != b->type;
+	if(!changed) return;
+
+	out_begin('~', b);
+	if(a->addr != b->addr) out_property("addr", a->addr, b->addr);
+	if(a->ret != b->ret) out_property("ret", a->ret, b->ret);
+	if(a->args != b->args) out_property("args", a->args, b->args);
+	if(a->regs != b->regs) out_property("regs", a->regs, b->regs);
+	if(a->stack_bytes != b->stack_bytes) out_number("stack_bytes", a->stack_bytes, b->stack_bytes);
+	if(a->type != b->type) out_property("type", a->type, b->type);
+	out_end();
+}
+
+/**
+ * @brief
+ * base type a field depends upon by value (arrays included, pointers excluded)
+ */
+static std::string_view field_base_type(std::string_view type){
+	if(type.find('*') != std::string_view::npos) return std::string_view();
+	size_t dim = type.find('[');
+	if(dim != std::string_view::npos) type = type.substr(0, dim);
+	while(!type.empty() && type.back() == ' ') type.remove_suffix(1);
+	return type;
+}
+
+static void diff_struct(const kb *kb_a,
+	const std::unordered_map<std::string_view, std::vector<const kb_item *>> &dependents,
+	const kb_item *a, const kb_item *b
+){
+	std::unordered_map<std::string_view, const kb_field *> fields_a;
+	fields_a.reserve(a->fields.size());
+	for(const kb_field &f : a->fields) fields_a[f.name] = &f;
+
+	std::vector<const kb_field *> added, removed, changed;
+	std::unordered_set<std::string_view> seen;
+	for(const kb_field &f : b->fields){
+		seen.insert(f.name);
+		auto it = fields_a.find(f.name);
+		if(it == fields_a.end()){
+			added.push_back(&f);
+		} else if(it->second->offset != f.offset
+			|| it->second->size != f.size
+			|| it->second->type != f.type
+		){
+			changed.push_back(&f);
+		}
+	}
+	for(const kb_field &f : a->fields){
+		if(seen.find(f.name) == seen.end()) removed.push_back(&f);
+	}
+
+	if(a->size == b->size && added.empty() && removed.empty() && changed.empty()){
+		return;
+	}
+
+	out_begin('~', b);
+	if(a->size != b->size) out_number("size", a->size, b->size);
+
+	if(gen_json) printf(",\n  \"fields\": [");
+	bool first = true;
+	auto out_field = [&](char marker, const kb_field *fa, const kb_field *fb){
+		const kb_field *f = (fb) ? fb : fa;
+		if(gen_json){
+			printf("%s\n    { \"change\": \"%s\", \"name\": \"%.*s\"",
+				(first) ? "" : ",",
+				(marker == '+') ? "added" : (marker == '-') ? "removed" : "changed",
+				SV(f->name));
+			if(fa) printf(", \"old\": { \"type\": \"%.*s\", \"offset\": %ld, \"size\": %ld }",
+				SV(fa->type), fa->offset, fa->size);
+			if(fb) printf(", \"new\": { \"type\": \"%.*s\", \"offset\": %ld, \"size\": %ld }",
+				SV(fb->type), fb->offset, fb->size);
+			printf(" }");
+		} else {
+			printf("    %c field %.*s:", marker, SV(f->name));
+			if(fa) printf(" %.*s @0x%lx size %ld", SV(fa->type), fa->offset, fa->size);
+			if(fa && fb) printf(" ->");
+			if(fb) printf(" %.*s @0x%lx size %ld", SV(fb->type), fb->offset, fb->size);
+			printf("\n");
+		}
+		first = false;
+	};
+	for(const kb_field *f : removed) out_field('-', f, NULL);
+	for(const kb_field *f : added) out_field('+', NULL, f);
+	for(const kb_field *f : changed) out_field('~', fields_a.at(f->name), f);
+	if(gen_json) printf("\n  ]");
+
+	if(a->size != b->size){
+		/**
+		 * walk the structs embedding this one (in the new KB)
+		 * and list those whose size changed as well
+		 */
+		std::vector<const kb_item *> resized;
+		std::unordered_set<std::string_view> visited = { b->name };
+		std::vector<std::string_view> queue = { b->name };
+		while(!queue.empty()){
+			std::string_view name = queue.back();
+			queue.pop_back();
+			auto it = dependents.find(name);
+			if(it == dependents.end()) continue;
+			for(const kb_item *dep : it->second){
+				if(!visited.insert(dep->name).second) continue;
+				queue.push_back(dep->name);
+				auto old = kb_a->index[KB_STRUCT].find(dep->name);
+				if(old != kb_a->index[KB_STRUCT].end() && old->second->size != dep->size){
+					resized.push_back(dep);
+				}
+			}
+		}
+		if(gen_json){
+			printf(",\n  \"resized_dependents\": [");
+			for(size_t i=0; i<resized.size(); i++){
+				printf("%s\"%.*s\"", (i > 0) ? ", " : "", SV(resized[i]->name));
+			}
+			printf("]");
+		} else if(!resized.empty()){
+			printf("    resized dependents:");
+			for(const kb_item *dep : resized) printf(" %.*s", SV(dep->name));
+			printf("\n");
+		}
+	}
+	out_end();
+}
+
+static void usage(const char *argv0){
+	fprintf(stderr, "Usage: %s [-json] <old kb.json> <new kb.json>\n", argv0);
+}
+
+int main(int argc, const char **argv){
+	const char *filenames[2] = { NULL, NULL };
+	int num_files = 0;
+	for(int i = 1; i < argc; i++){
+		const char *arg = argv[i];
+		if(!strcmp(arg, "-json")){
+			gen_json = true;
+			continue;
+		}
+		if(num_files >= 2){
+			usage(argv[0]);
+			return 2;
+		}
+		filenames[num_files++] = arg;
+	}
+	if(num_files != 2){
+		usage(argv[0]);
+		return 2;
+	}
+
+	static kb kb_a, kb_b;
+	if(!kb_load(&kb_a, filenames[0]) || !kb_load(&kb_b, filenames[1])){
+		return 2;
+	}
+
+	// reverse dependencies: struct name -> structs embedding it by value
+	std::unordered_map<std::string_view, std::vector<const kb_item *>> dependents;
+	dependents.reserve(kb_b.index[KB_STRUCT].size());
+	for(const kb_item &item : kb_b.items){
+		if(item.item_type != KB_STRUCT) continue;
+		for(const kb_field &f : item.fields){
+			std::string_view base = field_base_type(f.type);
+			if(base.empty() || kb_b.index[KB_STRUCT].find(base) == kb_b.index[KB_STRUCT].end()){
+				continue;
+			}
+			std::vector<const kb_item *> &deps = dependents[base];
+			if(deps.empty() || deps.back() != &item) deps.push_back(&item);
+		}
+	}
+
+	if(gen_json) printf("[");
+
+	// removed: probe the old KB against the new index
+	for(const kb_item &item : kb_a.items){
+		if(item.item_type == KB_NUM_TYPES || item.name.empty()) continue;
+		const auto &index = kb_b.index[item.item_type];
+		if(index.find(item.name) == index.end()){
+			out_begin('-', &item);
+			out_end();
+		}
+	}
+
+	// added or changed: probe the new KB against the old index
+	for(const kb_item &item : kb_b.items){
+		if(item.item_type == KB_NUM_TYPES || item.name.empty()) continue;
+		const auto &index = kb_a.index[item.item_type];
+		auto it = index.find(item.name);
+		if(it == index.end()){
+			out_begin('+', &item);
+			out_end();
+			continue;
+		}
+		if(item.item_type == KB_STRUCT){
+			diff_struct(&kb_a, dependents, it->second, &item);
+		} else {
+			diff_scalar(it->second, &item);
+		}
+	}
+
+	if(gen_json) printf("\n]\n");
+
+	// same convention as diff(1)
+	return (num_changes > 0) ? 1 : 0;
+}
@@ -0,0 +1,887 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * bulk importer from disassembler symbol maps (CSV or JSON) to metadata declarations.
+ * the map is memory mapped and parsed in place, symbols are deduplicated by address
+ * with a hash index, and the declarations are written to sharded headers.
+ * declarations already present in the merged headers, or in shards edited by hand,
+ * always win over the imported ones
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "json_reader.h"
+
+enum sym_kind {
+	SYM_FUNCTION = 0,
+	SYM_DATA,
+	SYM_STRUCT,
+	SYM_FIELD,
+	SYM_UNKNOWN
+};
+
+/**
+ * @brief a row of the symbol map. all strings point into the mapped file,
+ * or into `unescaped` for quoted CSV values
+ */
+struct sym_row {
+	enum sym_kind kind = SYM_UNKNOWN;
+	std::string_view addr;
+	std::string_view name;
+	/** return type, data type or field type */
+	std::string_view type;
+	std::string_view args;
+	/** owning struct, for fields */
+	std::string_view parent;
+	/** cdecl, stdcall, fastcall */
+	std::string_view conv;
+	long size = -1;
+	long offset = -1;
+	long stack_bytes = -1;
+};
+
+static std::deque<std::string> unescaped;
+
+static enum sym_kind parse_kind(std::string_view s){
+	if(s == "function" || s == "func" || s == "code") return SYM_FUNCTION;
+	if(s == "data" || s == "global") return SYM_DATA;
+	if(s == "struct") return SYM_STRUCT;
+	if(s == "field" || s == "member") return SYM_FIELD;
+	return SYM_UNKNOWN;
+}
+
+/** addresses are hexadecimal, with or without 0x */
+static bool parse_addr(std::string_view s, uint64_t *out){
+	if(s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s.remove_prefix(2);
+	if(s.empty() || s.size() > 16) return false;
+	uint64_t v = 0;
+	for(char c : s){
+		int d;
+		if(c >= '0' && c <= '9') d = c - '0';
+		else if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+		else if(c >= 'A' && c <= 'F') d = c - 'A' + 10;
+		else return false;
+		v = (v << 4) | d;
+	}
+	*out = v;
+	return true;
+}
+
+/** decimal or 0x-prefixed hexadecimal, -1 if missing or invalid */
+static long parse_long(std::string_view s){
+	if(s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')){
+		uint64_t v;
+		return parse_addr(s, &v) ? (long)v : -1;
+	}
+	if(s.empty()) return -1;
+	long v = 0;
+	for(char c : s){
+		if(c < '0' || c > '9') return -1;
+		v = v * 10 + (c - '0');
+	}
+	return v;
+}
+
+static std::string_view trim(std::string_view s){
+	while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+	while(!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+	return s;
+}
+
+/**
+ * @brief sets a property of `row` from its CSV column or JSON key
+ */
+static void set_property(sym_row *row, std::string_view key, std::string_view value){
+	value = trim(value);
+	if(key == "kind") row->kind = parse_kind(value);
+	else if(key == "addr" || key == "address") row->addr = value;
+	else if(key == "name") row->name = value;
+	else if(key == "type") row->type = value;
+	else if(key == "args") row->args = value;
+	else if(key == "parent" || key == "struct") row->parent = value;
+	else if(key == "conv" || key == "convention") row->conv = value;
+	else if(key == "size") row->size = parse_long(value);
+	else if(key == "offset") row->offset = parse_long(value);
+	else if(key == "stack_bytes") row->stack_bytes = parse_long(value);
+}
+
+/**
+ * @brief
+ * CSV (RFC 4180) reader: the first line names the columns, in any order.
+ * quoted values may contain commas, newlines and doubled quotes
+ */
+struct csv_reader {
+	const char *p;
+	const char *end;
+};
+
+/** @return false at the end of the line */
+static bool csv_value(csv_reader *r, std::string_view *out){
+	if(r->p < r->end && *r->p == '"'){
+		const char *begin = ++r->p;
+		bool escaped = false;
+		while(r->p < r->end){
+			if(*r->p == '"'){
+				if(r->p + 1 < r->end && r->p[1] == '"'){
+					escaped = true;
+					r->p += 2;
+					continue;
+				}
+				break;
+			}
+			++r->p;
+		}
+		*out = std::string_view(begin, r->p - begin);
+		if(escaped){
+			std::string s;
+			s.reserve(out->size());
+			for(size_t i = 0; i < out->size(); i++){
+				s += (*out)[i];
+				if((*out)[i] == '"') i++;
+			}
+			unescaped.push_back(std::move(s));
+			*out = unescaped.back();
+		}
+		if(r->p < r->end) ++r->p;
+	} else {
+		const char *begin = r->p;
+		while(r->p < r->end && *r->p != ',' && *r->p != '\n') ++r->p;
+		*out = std::string_view(begin, r->p - begin);
+	}
+	if(r->p < r->end && *r->p == ','){
+		++r->p;
+		return true;
+	}
+	// \r is trimmed from the value
+	while(r->p < r->end && *r->p != '\n') ++r->p;
+	if(r->p < r->end) ++r->p;
+	return false;
+}
+
+template <typename F>
+static bool csv_parse(const char *data, size_t size, F &&on_row){
+	csv_reader r = { data, data + size };
+	std::vector<std::string_view> columns;
+	std::string_view value;
+	bool more = true;
+	while(more && r.p < r.end){
+		more = csv_value(&r, &value);
+		columns.push_back(trim(value));
+	}
+	if(std::find(columns.begin(), columns.end(), "kind") == columns.end()){
+		fprintf(stderr, "CSV header without a `kind` column\n");
+		return false;
+	}
+	while(r.p < r.end){
+		sym_row row;
+		size_t col = 0;
+		do {
+			more = csv_value(&r, &value);
+			if(col < columns.size()) set_property(&row, columns[col], value);
+			col++;
+		} while(more);
+		if(col > 1 || !value.empty()) on_row(row);
+	}
+	return true;
+}
+
+/**
+ * @brief
+ * JSON input: an array of flat objects, with the same keys as the CSV columns.
+ * numbers and strings are both accepted as values (escapes are kept as-is)
+ */
+template <typename F>
+static bool json_parse(const char *data, size_t size, F &&on_row){
+	json_reader r = { data, data + size, NULL };
+	bool ok = json_expect(&r, '[');
+	if(ok && json_peek(&r, ']')) return true;
+	while(ok){
+		sym_row row;
+		ok = json_expect(&r, '{');
+		if(ok && !json_peek(&r, '}')){
+			do {
+				std::string_view key, value;
+				ok = json_string(&r, &key) && json_expect(&r, ':') && json_scalar(&r, &value);
+				if(ok) set_property(&row, key, value);
+			} while(ok && json_peek(&r, ',') && ++r.p);
+		}
+		ok = ok && json_expect(&r, '}');
+		if(!ok) break;
+		on_row(row);
+		if(!json_peek(&r, ',')) break;
+		++r.p;
+	}
+	if(ok) ok = json_expect(&r, ']');
+	if(!ok){
+		fprintf(stderr, "JSON parse error at offset %zu\n", (size_t)((r.error ? r.error : r.p) - data));
+	}
+	return ok;
+}
+
+/**
+ * @brief read-only view of a whole file
+ */
+struct mapped_file {
+	const char *data = NULL;
+	size_t size = 0;
+	std::string fallback;
+};
+
+static bool map_file(mapped_file *mf, const char *filename){
+#ifndef _WIN32
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0){
+		fprintf(stderr, "Failed to open file '%s' for reading\n", filename);
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) == 0 && st.st_size > 0){
+		void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(mem != MAP_FAILED){
+			madvise(mem, st.st_size, MADV_SEQUENTIAL);
+			mf->data = (const char *)mem;
+			mf->size = st.st_size;
+			close(fd);
+			return true;
+		}
+	}
+	close(fd);
+#endif
+	FILE *fh = fopen(filename, "rb");
+	if(!fh){
+		fprintf(stderr, "Failed to open file '%s' for reading\n", filename);
+		return false;
+	}
+	fseek(fh, 0, SEEK_END);
+	long length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+	mf->fallback.resize(length);
+	if(length > 0 && fread(&mf->fallback[0], length, 1, fh) != 1){
+		fclose(fh);
+		return false;
+	}
+	fclose(fh);
+	mf->data = mf->fallback.data();
+	mf->size = mf->fallback.size();
+	return true;
+}
+
+static void unmap_file(mapped_file *mf){
+#ifndef _WIN32
+	if(mf->data && mf->fallback.empty()) munmap((void *)mf->data, mf->size);
+#endif
+	mf->data = NULL;
+}
+
+/**
+ * @brief
+ * declarations found in existing headers. these are never overwritten
+ */
+struct existing_decls {
+	std::unordered_set<uint64_t> addrs;
+	std::unordered_set<std::string> names;
+	std::unordered_set<std::string> structs;
+};
+
+/** splits the top level arguments of the macro call starting at `p` */
+static const char *macro_args(const char *p, const char *end, std::vector<std::string_view> &args){
+	args.clear();
+	while(p < end && (*p == ' ' || *p == '\t')) p++;
+	if(p >= end || *p != '(') return p;
+	const char *begin = ++p;
+	int depth = 0;
+	for(; p < end; p++){
+		if(*p == '(' || *p == '[') depth++;
+		else if((*p == ')' || *p == ']') && depth > 0) depth--;
+		else if(*p == ')' || (*p == ',' && depth == 0)){
+			args.push_back(trim(std::string_view(begin, p - begin)));
+			begin = p + 1;
+			if(*p == ')') return p + 1;
+		}
+	}
+	return p;
+}
+
+static const char *decl_macros[] = {
+	"DECLARE_TARGET_FUNCTION_THUNK",
+	"DECLARE_TARGET_FUNCTION",
+	"DECLARE_FASTCALL_FUNCTION",
+	"DECLARE_STDCALL_FUNCTION",
+	"DECLARE_TARGET_DATA_ARRAY",
+	"DECLARE_TARGET_DATA_DECL",
+	"DECLARE_TARGET_DATA",
+	"BEGIN_META_STRUCT"
+};
+
+static inline bool is_ident_char(char c){
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/** single pass over the identifiers of `data`, collecting the declaration macros */
+static void scan_decls(const char *data, size_t size, existing_decls *ex){
+	const char *end = data + size;
+	std::vector<std::string_view> args;
+	for(const char *p = data; p < end;){
+		if(!is_ident_char(*p)){
+			p++;
+			continue;
+		}
+		const char *ident = p;
+		while(p < end && is_ident_char(*p)) p++;
+		if(*ident != 'B' && *ident != 'D') continue;
+		std::string_view name(ident, p - ident);
+		for(const char *macro : decl_macros){
+			if(name != macro) continue;
+			p = macro_args(p, end, args);
+			if(macro[0] == 'B'){
+				if(args.size() >= 1) ex->structs.insert(std::string(args[0]));
+			} else if(args.size() >= 3){
+				uint64_t addr;
+				if(parse_addr(args[0], &addr)) ex->addrs.insert(addr);
+				ex->names.insert(std::string(args[2]));
+			}
+			break;
+		}
+	}
+}
+
+/**
+ * @brief a generated shard: a marker line with the checksum of the body, and the body.
+ * a shard whose body doesn't match its checksum was edited by hand, and is kept
+ */
+#define SHARD_MARKER "/* generated by kb-import, checksum "
+
+static uint64_t checksum(const char *data, size_t size){
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(size_t i = 0; i < size; i++){
+		hash = (hash ^ (uint8_t)data[i]) * 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static bool is_pristine_shard(const char *data, size_t size){
+	size_t marker_len = strlen(SHARD_MARKER);
+	if(size < marker_len || memcmp(data, SHARD_MARKER, marker_len)) return false;
+	const char *nl = (const char *)memchr(data, '\n', size);
+	if(!nl) return false;
+	unsigned long long expected = strtoull(data + marker_len, NULL, 16);
+	return checksum(nl + 1, size - (nl + 1 - data)) == expected;
+}
+
+static std::string shard_name(const std::string &dir, const char *prefix, unsigned index){
+	char buf[32];
+	snprintf(buf, sizeof(buf), "_%03u.h", index);
+	return dir + "/" + prefix + buf;
+}
+
+static bool file_exists(const std::string &path){
+	FILE *fh = fopen(path.c_str(), "rb");
+	if(fh) fclose(fh);
+	return fh != NULL;
+}
+
+/**
+ * @brief writes `filename`, only if its contents differ
+ * (so that the dependent targets aren't rebuilt needlessly)
+ */
+static bool write_file(const std::string &filename, const std::string &data){
+	mapped_file old;
+	if(file_exists(filename) && map_file(&old, filename.c_str())){
+		bool same = old.size == data.size() && !memcmp(old.data, data.data(), data.size());
+		unmap_file(&old);
+		if(same) return true;
+	}
+	FILE *fh = fopen(filename.c_str(), "wb");
+	if(!fh){
+		fprintf(stderr, "Failed to open file '%s' for writing\n", filename.c_str());
+		return false;
+	}
+	fwrite(data.data(), data.size(), 1, fh);
+	fclose(fh);
+	return true;
+}
+
+struct import_decl {
+	uint64_t addr;
+	std::string_view raw_name;
+	std::string name;
+	std::string line;
+};
+
+struct import_field {
+	long offset;
+	long size;
+	std::string_view name;
+	std::string_view type;
+};
+
+struct import_struct {
+	std::string name;
+	/** `name` as a C identifier */
+	std::string id;
+	long size = -1;
+	std::vector<import_field> fields;
+	bool emitted = false;
+	bool visiting = false;
+};
+
+struct import_stats {
+	unsigned rows = 0;
+	unsigned unknown = 0;
+	unsigned duplicates = 0;
+	unsigned conflicts = 0;
+	unsigned existing = 0;
+	unsigned renamed = 0;
+	unsigned bad_fields = 0;
+};
+
+static import_stats stats;
+static existing_decls existing;
+
+static std::vector<import_decl> decls;
+static std::unordered_map<uint64_t, uint32_t> decl_by_addr;
+static std::unordered_set<std::string> used_names;
+
+static std::deque<import_struct> structs;
+static std::unordered_map<std::string_view, import_struct *> struct_by_name;
+
+/** turns a disassembler name (e.g. `??0Foo@@QAE@XZ`) into a C identifier */
+static std::string sanitize_identifier(std::string_view name){
+	std::string id;
+	id.reserve(name.size() + 1);
+	for(char c : name){
+		id += (isalnum((unsigned char)c) || c == '_') ? c : '_';
+	}
+	if(id.empty() || isdigit((unsigned char)id[0])) id.insert(0, "_");
+	return id;
+}
+
+/**
+ * @brief appends `_<suffix>` to `id` if it's already taken
+ * @param global also check the names declared in the merged headers
+ */
+static std::string unique_identifier(std::string id, uint64_t suffix, const std::unordered_set<std::string> &taken, bool global){
+	if(taken.count(id) || (global && existing.names.count(id))){
+		char buf[24];
+		snprintf(buf, sizeof(buf), "_%llx", (unsigned long long)suffix);
+		id += buf;
+		++stats.renamed;
+	}
+	return id;
+}
+
+static std::string c_identifier(std::string_view name, uint64_t addr){
+	return unique_identifier(sanitize_identifier(name), addr, used_names, true);
+}
+
+/** splits `char[16][2]` into `char` and `16, 2` */
+static std::string_view split_dims(std::string_view type, std::string *dims){
+	size_t bracket = type.find('[');
+	if(bracket == std::string_view::npos) return type;
+	for(size_t i = bracket; i < type.size(); i++){
+		char c = type[i];
+		if(c == '[') continue;
+		if(c == ']'){
+			if(i + 1 < type.size() && type[i + 1] == '[') *dims += ", ";
+			continue;
+		}
+		*dims += c;
+	}
+	return trim(type.substr(0, bracket));
+}
+
+static void add_symbol(const sym_row &row, uint64_t addr){
+	auto it = decl_by_addr.find(addr);
+	if(it != decl_by_addr.end()){
+		++stats.duplicates;
+		if(decls[it->second].raw_name != row.name) ++stats.conflicts;
+		return;
+	}
+	if(existing.addrs.count(addr)){
+		++stats.existing;
+		return;
+	}
+
+	import_decl d;
+	d.addr = addr;
+	d.raw_name = row.name;
+	d.name = c_identifier(row.name, addr);
+
+	char addr_str[24];
+	snprintf(addr_str, sizeof(addr_str), "0x%llx", (unsigned long long)addr);
+
+	if(row.kind == SYM_FUNCTION){
+		std::string_view ret = row.type.empty() ? std::string_view("int") : row.type;
+		std::string_view args = row.args.empty() ? std::string_view("void") : row.args;
+		if(row.conv == "stdcall" || row.conv == "__stdcall"){
+			d.line = std::string("DECLARE_STDCALL_FUNCTION(") + addr_str + ", " + std::string(ret) + ", " + d.name
+				+ ", " + std::to_string((row.stack_bytes >= 0) ? row.stack_bytes : 0) + ", " + std::string(args) + ");\n";
+		} else {
+			const char *macro = (row.conv == "fastcall" || row.conv == "__fastcall")
+				? "DECLARE_FASTCALL_FUNCTION(" : "DECLARE_TARGET_FUNCTION(";
+			d.line = std::string(macro) + addr_str + ", " + std::string(ret) + ", " + d.name + ", " + std::string(args) + ");\n";
+		}
+	} else {
+		std::string dims;
+		std::string_view type = split_dims(row.type, &dims);
+		if(type.empty() && row.size > 1){
+			type = "unsigned char";
+			dims = std::to_string(row.size);
+		} else if(type.empty()){
+			type = "int";
+		}
+		if(dims.empty()){
+			d.line = std::string("DECLARE_TARGET_DATA(") + addr_str + ", " + std::string(type) + ", " + d.name + ");\n";
+		} else {
+			d.line = std::string("DECLARE_TARGET_DATA_ARRAY(") + addr_str + ", " + std::string(type) + ", " + d.name + ", " + dims + ");\n";
+		}
+	}
+
+	used_names.insert(d.name);
+	decl_by_addr.emplace(addr, (uint32_t)decls.size());
+	decls.push_back(std::move(d));
+}
+
+static import_struct *get_struct(std::string_view name){
+	auto it = struct_by_name.find(name);
+	if(it != struct_by_name.end()) return it->second;
+	structs.emplace_back();
+	import_struct *st = &structs.back();
+	st->name = std::string(name);
+	// structs share the namespace of functions and data; they have no address, use their index
+	st->id = sanitize_identifier(name);
+	if(!existing.structs.count(st->id)){
+		st->id = unique_identifier(st->id, structs.size() - 1, used_names, true);
+	}
+	used_names.insert(st->id);
+	struct_by_name.emplace(st->name, st);
+	return st;
+}
+
+static void on_row(const sym_row &row){
+	++stats.rows;
+	switch(row.kind){
+	case SYM_FUNCTION:
+	case SYM_DATA: {
+		uint64_t addr;
+		if(row.name.empty() || !parse_addr(row.addr, &addr)){
+			++stats.unknown;
+			return;
+		}
+		add_symbol(row, addr);
+		break;
+	}
+	case SYM_STRUCT: {
+		if(row.name.empty()){
+			++stats.unknown;
+			return;
+		}
+		import_struct *st = get_struct(row.name);
+		if(st->size >= 0) ++stats.duplicates;
+		else st->size = row.size;
+		break;
+	}
+	case SYM_FIELD: {
+		if(row.parent.empty() || row.name.empty() || row.type.empty() || row.offset < 0){
+			++stats.unknown;
+			return;
+		}
+		import_field f = { row.offset, row.size, row.name, row.type };
+		get_struct(row.parent)->fields.push_back(f);
+		break;
+	}
+	default:
+		++stats.unknown;
+		break;
+	}
+}
+
+/** `const struct foo *` -> `` (pointer), `foo` -> `foo` */
+static std::string_view value_type(std::string_view type){
+	if(type.find('*') != std::string_view::npos) return std::string_view();
+	std::string dims;
+	type = split_dims(type, &dims);
+	for(std::string_view q : { "const ", "volatile ", "struct " }){
+		if(type.substr(0, q.size()) == q) type = trim(type.substr(q.size()));
+	}
+	return type;
+}
+
+/** emits the structs embedded by value in `st` first, so the output compiles */
+static void emit_struct(import_struct *st, std::vector<import_struct *> &order){
+	if(st->emitted || st->visiting) return;
+	st->visiting = true;
+	for(const import_field &f : st->fields){
+		auto it = struct_by_name.find(value_type(f.type));
+		if(it != struct_by_name.end() && it->second != st) emit_struct(it->second, order);
+	}
+	st->visiting = false;
+	st->emitted = true;
+	order.push_back(st);
+}
+
+/**
+ * @brief replaces the name of an imported struct in `type` with its identifier.
+ * other types that aren't valid C (e.g. `std::string`) become opaque bytes, when their size is known
+ */
+static std::string field_type(std::string_view type, long size, std::string *dims){
+	std::string_view base = split_dims(type, dims);
+	size_t begin = 0;
+	for(std::string_view q : { "const ", "volatile ", "struct " }){
+		if(base.substr(begin, q.size()) == q) begin += q.size();
+	}
+	size_t end = base.find('*');
+	if(end == std::string_view::npos) end = base.size();
+	std::string_view name = trim(base.substr(begin, end - begin));
+	begin = name.data() - base.data();
+
+	auto it = struct_by_name.find(name);
+	if(it != struct_by_name.end()){
+		return std::string(base.substr(0, begin)) + it->second->id + std::string(base.substr(begin + name.size()));
+	}
+	for(char c : name){
+		if(isalnum((unsigned char)c) || c == '_' || c == ' ') continue;
+		if(size <= 0) break;
+		*dims = std::to_string(size);
+		return "unsigned char";
+	}
+	return std::string(base);
+}
+
+static std::string struct_decl(import_struct *st){
+	std::sort(st->fields.begin(), st->fields.end(), [](const import_field &a, const import_field &b){
+		return a.offset < b.offset;
+	});
+	long size = st->size;
+	if(size < 0){
+		for(const import_field &f : st->fields){
+			size = std::max(size, f.offset + std::max(f.size, 1L));
+		}
+	}
+
+	std::string out = "BEGIN_META_STRUCT(" + st->id + ", " + std::to_string(size) + ")\n";
+	long last_end = 0;
+	std::unordered_set<std::string> field_names;
+	for(const import_field &f : st->fields){
+		// overlapping (union) members and out of bounds fields are left out
+		if(f.offset < last_end || f.offset >= size || (f.size > 0 && f.offset + f.size > size)){
+			++stats.bad_fields;
+			continue;
+		}
+		last_end = f.offset + std::max(f.size, 1L);
+		std::string name = unique_identifier(sanitize_identifier(f.name), f.offset, field_names, false);
+		field_names.insert(name);
+		std::string dims;
+		std::string type = field_type(f.type, f.size, &dims);
+		if(dims.empty()){
+			out += "\tMETA_STRUCT_FIELD(" + std::to_string(f.offset) + ", " + type + ", " + name + ")\n";
+		} else {
+			out += "\tMETA_STRUCT_FIELD_ARRAY(" + std::to_string(f.offset) + ", " + type + ", "
+				+ name + ", " + dims + ")\n";
+		}
+	}
+	out += "END_META_STRUCT(" + st->id + ")\n\n";
+	return out;
+}
+
+/**
+ * @brief
+ * writes `<dir>/<prefix>_NNN.h` shards of up to `shard_size` declarations,
+ * and `<dir>/<prefix>.h` including all of them.
+ * shards edited by hand are kept and listed first, stale generated shards are removed
+ */
+static bool write_shards(const std::string &dir, const char *prefix,
+	const std::vector<unsigned> &kept, const std::vector<std::string> &lines, size_t shard_size
+){
+	std::vector<std::string> files;
+	for(unsigned index : kept){
+		files.push_back(shard_name(dir, prefix, index));
+	}
+
+	unsigned next = 0;
+	for(size_t begin = 0; begin < lines.size(); begin += shard_size){
+		while(std::find(kept.begin(), kept.end(), next) != kept.end()) next++;
+		std::string body = "#pragma once\n";
+		for(size_t i = begin; i < std::min(begin + shard_size, lines.size()); i++){
+			body += lines[i];
+		}
+		char marker[80];
+		snprintf(marker, sizeof(marker), SHARD_MARKER "%016llx, edit to keep it as is */\n",
+			(unsigned long long)checksum(body.data(), body.size()));
+		std::string filename = shard_name(dir, prefix, next++);
+		if(!write_file(filename, marker + body)) return false;
+		files.push_back(filename);
+	}
+
+	// shards left over from a bigger import
+	for(;; next++){
+		if(std::find(kept.begin(), kept.end(), next) != kept.end()) continue;
+		std::string filename = shard_name(dir, prefix, next);
+		if(!file_exists(filename)) break;
+		remove(filename.c_str());
+	}
+
+	std::string index = "/** generated by kb-import */\n#pragma once\n";
+	for(const std::string &f : files){
+		index += "#include \"" + f.substr(dir.size() + 1) + "\"\n";
+	}
+	return write_file(dir + "/" + prefix + ".h", index);
+}
+
+/** finds the hand-edited shards of `prefix` and records their declarations */
+static std::vector<unsigned> scan_shards(const std::string &dir, const char *prefix){
+	std::vector<unsigned> kept;
+	for(unsigned index = 0;; index++){
+		std::string filename = shard_name(dir, prefix, index);
+		if(!file_exists(filename)) break;
+		mapped_file mf;
+		if(!map_file(&mf, filename.c_str())) continue;
+		if(!is_pristine_shard(mf.data, mf.size)){
+			scan_decls(mf.data, mf.size, &existing);
+			kept.push_back(index);
+		}
+		unmap_file(&mf);
+	}
+	return kept;
+}
+
+static double now_seconds(){
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(const char *argv0){
+	fprintf(stderr, "Usage: %s -out <dir> [-merge <header>]... [-shard <decls>] [-csv|-json] <symbols>\n", argv0);
+}
+
+int main(int argc, const char **argv){
+	double t_start = now_seconds();
+
+	const char *out_dir = NULL;
+	const char *input = NULL;
+	std::vector<const char *> merge;
+	size_t shard_size = 2000;
+	int format = 0; // 'c' or 'j', guessed from the extension otherwise
+	for(int i = 1; i < argc; i++){
+		const char *arg = argv[i];
+		if(!strcmp(arg, "-out") && i + 1 < argc) out_dir = argv[++i];
+		else if(!strcmp(arg, "-merge") && i + 1 < argc) merge.push_back(argv[++i]);
+		else if(!strcmp(arg, "-shard") && i + 1 < argc) shard_size = strtoul(argv[++i], NULL, 0);
+		else if(!strcmp(arg, "-csv")) format = 'c';
+		else if(!strcmp(arg, "-json")) format = 'j';
+		else if(!input && arg[0] != '-') input = arg;
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(!out_dir || !input || shard_size == 0){
+		usage(argv[0]);
+		return 2;
+	}
+	if(!format){
+		size_t len = strlen(input);
+		format = (len >= 5 && !strcmp(input + len - 5, ".json")) ? 'j' : 'c';
+	}
+
+	// existing declarations win over the imported ones
+	for(const char *header : merge){
+		mapped_file mf;
+		if(!map_file(&mf, header)) return 2;
+		scan_decls(mf.data, mf.size, &existing);
+		unmap_file(&mf);
+	}
+	std::string dir = out_dir;
+#ifdef _WIN32
+	_mkdir(out_dir);
+#else
+	mkdir(out_dir, 0777);
+#endif
+	std::vector<unsigned> kept_target = scan_shards(dir, "target_import");
+	std::vector<unsigned> kept_types = scan_shards(dir, "meta_types_import");
+
+	mapped_file mf;
+	if(!map_file(&mf, input)) return 2;
+	// rough estimate, avoids most of the rehashing
+	decl_by_addr.reserve(mf.size / 48);
+	decls.reserve(mf.size / 48);
+	used_names.reserve(mf.size / 48);
+	bool ok = (format == 'j')
+		? json_parse(mf.data, mf.size, on_row)
+		: csv_parse(mf.data, mf.size, on_row);
+	if(!ok){
+		fprintf(stderr, "%s: parse error\n", input);
+		return 2;
+	}
+	double t_parse = now_seconds();
+
+	// by address, so that re-exports produce small diffs
+	std::sort(decls.begin(), decls.end(), [](const import_decl &a, const import_decl &b){
+		return a.addr < b.addr;
+	});
+	std::vector<std::string> target_lines;
+	target_lines.reserve(decls.size());
+	for(import_decl &d : decls){
+		target_lines.push_back(std::move(d.line));
+	}
+
+	std::vector<import_struct *> order;
+	for(import_struct &st : structs){
+		if(existing.structs.count(st.id)){
+			st.emitted = true;
+			++stats.existing;
+			continue;
+		}
+		emit_struct(&st, order);
+	}
+	std::vector<std::string> type_lines;
+	type_lines.reserve(order.size());
+	for(import_struct *st : order){
+		type_lines.push_back(struct_decl(st));
+	}
+
+	ok = write_shards(dir, "target_import", kept_target, target_lines, shard_size)
+		&& write_shards(dir, "meta_types_import", kept_types, type_lines, shard_size);
+	unmap_file(&mf);
+	if(!ok) return 2;
+
+	double t_end = now_seconds();
+	fprintf(stderr,
+		"%u rows: %zu functions/data, %zu structs written to %s\n"
+		"skipped: %u already declared, %u duplicate addresses (%u with different names), %u invalid rows, %u invalid fields\n"
+		"renamed: %u\n"
+		"kept %zu hand-edited shards\n"
+		"time: %.3fs (parse %.3fs)\n",
+		stats.rows, target_lines.size(), type_lines.size(), out_dir,
+		stats.existing, stats.duplicates, stats.conflicts, stats.unknown, stats.bad_fields,
+		stats.renamed,
+		kept_target.size() + kept_types.size(),
+		t_end - t_start, t_parse - t_start);
+	return 0;
+}
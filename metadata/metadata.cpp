@@ -5,9 +5,13 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
 
 //#define MSVC_SUPPORT
 
@@ -24,9 +28,37 @@ extern uint8_t *metadata_end();
 }
 #endif
 
+#include "watch.h"
+#include "json_reader.h"
+
+#include <algorithm>
 #include <string>
 #include <unordered_map>
-static std::unordered_map<const char *, struct __meta_struct *> struct_pointers;
+#include <vector>
+static std::unordered_map<std::string, struct __meta_struct *> struct_pointers;
+
+/**
+ * @brief
+ * struct layouts as resolved by handle_struct (sorted by offset, without padding).
+ * used by the emitters that run after all items have been processed
+ */
+struct resolved_struct {
+	const char *name;
+	int size;
+	std::vector<struct __meta_struct_field> fields;
+};
+static std::vector<resolved_struct> resolved_structs;
+
+/** structs to emit a struct-of-arrays view for (META_STRUCT_SOA) */
+struct soa_request {
+	const char *name;
+	std::vector<std::string> fields;
+};
+static std::vector<soa_request> soa_requests;
+
+/** functions to emit capture/replay stubs for (META_FUNCTION_CAPTURE) */
+static std::vector<const char *> capture_requests;
+static std::unordered_map<std::string, struct __meta_function_item *> function_items;
 
 static bool gen_data = 0;
 static bool gen_code = 0;
@@ -35,6 +67,44 @@ static bool gen_types = 0;
 static FILE *fh_json = NULL;
 static FILE *fh_hdr = NULL;
 static FILE *fh_debug = NULL;
+static FILE *fh_stats = NULL;
+static FILE *fh_layout = NULL;
+static FILE *fh_soa = NULL;
+static FILE *fh_capture = NULL;
+static FILE *fh_pool = NULL;
+static FILE *fh_mask = NULL;
+static FILE *fh_shadow = NULL;
+static FILE *fh_shadow_report = NULL;
+
+/**
+ * @brief
+ * self-profiling counters, written as JSON with -stats
+ * times are wall clock, in seconds
+ */
+static struct {
+	unsigned num_items[META_CAPTURE + 1];
+	unsigned num_fields;
+	unsigned padding_bytes;
+	unsigned update_struct_size_calls;
+	unsigned update_struct_size_depth;
+	unsigned update_struct_size_max_depth;
+	double time_section_copy;
+	/** update_struct_size, timed around the outermost call only */
+	double time_resolve;
+	/** struct declarations (without their resolution) */
+	double time_header;
+	/** function and data items */
+	double time_json;
+	/** the other generated headers */
+	double time_outputs;
+	double time_total;
+} stats;
+
+static double now_seconds(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
 #define OUT_JSON(fmt, ...) fprintf(fh_json, fmt, ##__VA_ARGS__)
 #define OUT_HDR(fmt, ...) fprintf(fh_hdr, fmt, ##__VA_ARGS__)
@@ -49,6 +119,10 @@ const char *meta_type_name(enum __meta_item_type type)
     return "data";
   case META_STRUCT:
     return "struct";
+  case META_SOA:
+    return "soa";
+  case META_CAPTURE:
+    return "capture";
   default:
     return "unknown";
   }
@@ -56,6 +130,7 @@ const char *meta_type_name(enum __meta_item_type type)
 
 ssize_t handle_func_ref(struct __meta_function_item *ref){
   if (!ref->name) return -1;
+  function_items[ref->name] = ref;
   ssize_t size = sizeof(*ref);
   if(!gen_code) return size;
 
@@ -154,7 +229,22 @@ static void dispose_fh(FILE *fh){
 	fclose(fh);
 }
 
+static ssize_t do_update_struct_size(struct __meta_struct *st);
+
 ssize_t update_struct_size(struct __meta_struct *st){
+	++stats.update_struct_size_calls;
+	if(++stats.update_struct_size_depth > stats.update_struct_size_max_depth){
+		stats.update_struct_size_max_depth = stats.update_struct_size_depth;
+	}
+	bool outermost = stats.update_struct_size_depth == 1;
+	double t_begin = (outermost) ? now_seconds() : 0;
+	ssize_t ret = do_update_struct_size(st);
+	if(outermost) stats.time_resolve += now_seconds() - t_begin;
+	--stats.update_struct_size_depth;
+	return ret;
+}
+
+static ssize_t do_update_struct_size(struct __meta_struct *st){
 	//DEBUG("update_struct_size for %s\n", st->name);
 	struct __meta_struct_field *f;
 
@@ -215,11 +305,6 @@ ssize_t handle_struct(struct __meta_struct *st)
 
 
   if (gen_types) {
-    OUT_JSON(
-      "{\n"
-      "  \"item_type\": \"struct\"\n"
-      "}"
-    );
     OUT_HDR(
       "#ifdef _MSC_VER\n"
       "#pragma pack(push, 1)\n"
@@ -240,6 +325,8 @@ ssize_t handle_struct(struct __meta_struct *st)
   //`f` points to the last field, skip it to know the end
   ++f;
 
+  stats.num_fields += num_fields;
+
   // always insert 0-sized field at the start, for initial padding
   ++num_fields;
 
@@ -275,6 +362,7 @@ ssize_t handle_struct(struct __meta_struct *st)
 
     fields[0] = initial_padding;
     ++pad_field_num;
+    if(gen_types) stats.padding_bytes += initial_pad_size;
   }
 
   int cumulative_size = 0;
@@ -347,6 +435,7 @@ ssize_t handle_struct(struct __meta_struct *st)
         OUT_HDR("  uint8_t __padding%d[%d]; ///< offset=0x%x\n", pad_field_num++,
                 padding, f->offset + f->size);
         cumulative_size += padding;
+        stats.padding_bytes += padding;
       }
 
       DEBUG(" f [%d-%d] %s %s (%d)\n", f->offset, f->offset + f->size, f->type,
@@ -361,6 +450,7 @@ ssize_t handle_struct(struct __meta_struct *st)
     OUT_HDR("  uint8_t __padding%d[%d]; ///< offset=0x%x\n", pad_field_num++,
                 padding, f->offset + f->size);
     cumulative_size += padding;
+    if(gen_types) stats.padding_bytes += padding;
   }
 
   if(gen_types) {
@@ -383,69 +473,1010 @@ ssize_t handle_struct(struct __meta_struct *st)
     OUT_HDR("static_assert(offsetof(%s, %s) == %d);\n", st->name, f->name, f->offset);
   }
 
+  if(gen_types){
+    /**
+     * emitted last, so that field sizes are resolved.
+     * the first field is the synthetic initial padding, skip it
+     */
+    resolved_struct resolved = { st->name, st->size };
+    for(int i=1; i<num_fields; i++){
+      if(fields[i].name) resolved.fields.push_back(fields[i]);
+    }
+    resolved_structs.push_back(resolved);
+
+    OUT_JSON("{\n"
+             "  \"item_type\": \"struct\",\n"
+             "  \"name\": \"%s\",\n"
+             "  \"size\": %d,\n"
+             "  \"fields\": [",
+             st->name, st->size);
+    bool first_field = true;
+    for(const struct __meta_struct_field &rf : resolved_structs.back().fields){
+      OUT_JSON("%s\n"
+               "    { \"name\": \"%s\", \"type\": \"%s\", \"offset\": %d, \"size\": %d }",
+               (first_field) ? "" : ",",
+               rf.name, rf.type, rf.offset, rf.size);
+      first_field = false;
+    }
+    OUT_JSON("\n  ]\n}");
+  }
+
   free(fields);
 
   ssize_t size = end - begin;
   return size;
 }
 
-int main(int argc, const char **argv, const char **envp)
-{
-  fh_json = stdout;
-  fh_hdr = stdout;
-  fh_debug = stderr;
+/**
+ * @brief
+ * emits the field tables of all structs, to be used at runtime
+ * (types are declared in target/layout.h)
+ */
+static void write_layouts(FILE *fh){
+	fprintf(fh, "/** generated by metadata -out-layout, include after layout.h */\n");
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.fields.empty()) continue;
+		fprintf(fh, "static const struct meta_layout_field __layout_fields_%s[] = {\n", rs.name);
+		for(const struct __meta_struct_field &f : rs.fields){
+			fprintf(fh, "  { \"%s\", \"%s\", %d, %d },\n", f.name, f.type, f.offset, f.size);
+		}
+		fprintf(fh, "};\n");
+	}
+	fprintf(fh, "static const struct meta_layout meta_layouts[] = {\n");
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.fields.empty()){
+			fprintf(fh, "  { \"%s\", %d, 0, NULL },\n", rs.name, rs.size);
+		} else {
+			fprintf(fh, "  { \"%s\", %d, %zu, __layout_fields_%s },\n",
+				rs.name, rs.size, rs.fields.size(), rs.name);
+		}
+	}
+	fprintf(fh, "  { NULL, 0, 0, NULL }\n"
+		"};\n");
+}
 
-  setvbuf(fh_debug, NULL, _IONBF, 0);
+/**
+ * @brief
+ * emits one allocator size class per distinct struct size,
+ * and typed new/delete helpers for each struct (see target/pool.h)
+ */
+static void write_pool(FILE *fh){
+	std::vector<int> sizes;
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.size > 0) sizes.push_back(rs.size);
+	}
+	std::sort(sizes.begin(), sizes.end());
+	sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+	fprintf(fh, "/** generated by metadata -out-pool, included by pool.h */\n"
+		"#pragma once\n"
+		"#define POOL_NUM_CLASSES %zu\n", sizes.size());
+
+	std::vector<std::string> class_structs(sizes.size());
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.size <= 0) continue;
+		size_t cls = std::lower_bound(sizes.begin(), sizes.end(), rs.size) - sizes.begin();
+		if(!class_structs[cls].empty()) class_structs[cls] += " ";
+		class_structs[cls] += rs.name;
+
+		fprintf(fh, "\n#define POOL_CLASS_%s %zu\n"
+			"static inline %s *pool_new_%s(void){ return (%s *)POOL_ALLOC(%zu, %d); }\n"
+			"static inline void pool_delete_%s(%s *p){ POOL_FREE(%zu, p, %d); }\n"
+			"static inline size_t pool_new_n_%s(%s **out, size_t n){ return POOL_ALLOC_N(%zu, (void **)out, n, %d); }\n"
+			"static inline void pool_delete_n_%s(%s **p, size_t n){ POOL_FREE_N(%zu, (void **)p, n, %d); }\n",
+			rs.name, cls,
+			rs.name, rs.name, rs.name, cls, rs.size,
+			rs.name, rs.name, cls, rs.size,
+			rs.name, rs.name, cls, rs.size,
+			rs.name, rs.name, cls, rs.size);
+	}
 
+	fprintf(fh, "\n#ifdef POOL_CLASS_TABLE\n"
+		"static const struct pool_class pool_classes[] = {\n");
+	for(size_t i = 0; i < sizes.size(); i++){
+		fprintf(fh, "  { %d, \"%s\" },\n", sizes[i], class_structs[i].c_str());
+	}
+	fprintf(fh, "  { 0, NULL }\n"
+		"};\n"
+		"#endif\n");
+}
 
-	uint8_t *start = metadata_begin();
-	uint8_t *end = metadata_end();
-	size_t metadata_length = end - start;
+/** records up to this size get the specialised hash and equality */
+#define STRUCT_SMALL_SIZE 16
 
-	uint8_t *metadata_buffer = (uint8_t *)calloc(metadata_length, 1);
-	if(!metadata_buffer){
-		fprintf(stderr, "calloc(%zu) failed\n", metadata_length);
-		return EXIT_FAILURE;
+/**
+ * @brief mask word over `n` (<= 8) bytes, loaded like struct_small_load in target/structhash.h
+ * (the target is little-endian)
+ */
+static uint64_t small_mask_word(const uint8_t *m, size_t n){
+	uint64_t w = 0;
+	if(n >= 8){
+		for(int i = 0; i < 8; i++) w |= (uint64_t)m[i] << (i * 8);
+	} else if(n >= 4){
+		for(size_t i = 0; i < 4; i++){
+			w |= (uint64_t)m[i] << (i * 8);
+			w |= (uint64_t)m[n - 4 + i] << ((n - 4 + i) * 8);
+		}
+	} else if(n > 0){
+		w = m[0] | ((uint64_t)m[n / 2] << ((n / 2) * 8)) | ((uint64_t)m[n - 1] << ((n - 1) * 8));
 	}
-	memcpy(metadata_buffer, start, metadata_length);
+	return w;
+}
 
-	start = metadata_buffer;
-	end = start + metadata_length;
+/**
+ * @brief hash and equality of a record of at most STRUCT_SMALL_SIZE bytes:
+ * two masked words with constant masks, no loop and no tail
+ */
+static void write_small_mask(FILE *fh, const resolved_struct &rs, const std::vector<uint8_t> &mask){
+	uint64_t lo = small_mask_word(&mask[0], (rs.size >= 8) ? 8 : rs.size);
+	uint64_t hi = (rs.size >= 8) ? small_mask_word(&mask[rs.size - 8], 8) : 0;
+	fprintf(fh, "static inline uint64_t struct_hash_%s(const %s *p){\n"
+		"  uint64_t lo, hi;\n"
+		"  struct_small_load(p, %d, &lo, &hi);\n"
+		"  return struct_hash_small(lo & 0x%016" PRIx64 "ULL, hi & 0x%016" PRIx64 "ULL, %d);\n"
+		"}\n"
+		"static inline int struct_equal_%s(const %s *a, const %s *b){\n"
+		"  uint64_t la, ha, lb, hb;\n"
+		"  struct_small_load(a, %d, &la, &ha);\n"
+		"  struct_small_load(b, %d, &lb, &hb);\n"
+		"  return !(((la ^ lb) & 0x%016" PRIx64 "ULL) | ((ha ^ hb) & 0x%016" PRIx64 "ULL));\n"
+		"}\n"
+		"static inline void struct_hash_n_%s(uint64_t *out, const %s *p, size_t count){\n"
+		"  for(size_t i = 0; i < count; i++) out[i] = struct_hash_%s(&p[i]);\n"
+		"}\n"
+		"static inline size_t struct_find_%s(const %s *key, const %s *p, size_t count){\n"
+		"  for(size_t i = 0; i < count; i++){\n"
+		"    if(struct_equal_%s(key, &p[i])) return i;\n"
+		"  }\n"
+		"  return count;\n"
+		"}\n",
+		rs.name, rs.name, rs.size, lo, hi, rs.size,
+		rs.name, rs.name, rs.name, rs.size, rs.size, lo, hi,
+		rs.name, rs.name, rs.name,
+		rs.name, rs.name, rs.name, rs.name);
+}
 
-  const char *filename = NULL;
-  for (int i = 1; i < argc;) {
-    const char *arg = argv[i++];
-    if (!strcmp(arg, "-data")) {
-      gen_data = true;
-      continue;
-    }
-    if (!strcmp(arg, "-code")) {
-      gen_code = true;
-      continue;
-    }
-    if (!strcmp(arg, "-types")) {
-      gen_types = true;
-      continue;
-    }
-    if (!strcmp(arg, "-out-hdr")) {
-      filename = argv[i++];
-      FILE *out = fopen(filename, "w");
-      if (!out) {
-        fprintf(stderr, "Failed to open file '%s' for writing\n", filename);
-      } else {
-        fh_hdr = out;
-      }
-    }
-    if (!strcmp(arg, "-out-json")) {
-      filename = argv[i++];
-      FILE *out = fopen(filename, "w");
-      if (!out) {
-        fprintf(stderr, "Failed to open file '%s' for writing\n", filename);
-      } else {
-        fh_json = out;
-      }
-    }
-  }
+/**
+ * @brief
+ * emits, for each struct, a mask of the bytes covered by known fields,
+ * and hash/equality functions that ignore everything else (see target/structhash.h).
+ * fields that are metadata structs themselves use their own mask
+ */
+static void write_masks(FILE *fh){
+	fprintf(fh, "/** generated by metadata -out-mask */\n"
+		"#pragma once\n"
+		"#include \"structhash.h\"\n");
+
+	std::unordered_map<std::string, std::vector<uint8_t>> masks;
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.size <= 0) continue;
+		std::vector<uint8_t> &mask = masks[rs.name];
+		mask.assign(rs.size, 0);
+		for(const struct __meta_struct_field &f : rs.fields){
+			if(f.offset < 0 || f.size <= 0 || f.offset + f.size > rs.size) continue;
+			// element type of arrays
+			std::string type = f.type ? f.type : "";
+			type = type.substr(0, type.find('['));
+			while(!type.empty() && type.back() == ' ') type.pop_back();
+
+			auto inner = masks.find(type);
+			if(inner != masks.end() && inner->first != rs.name && !inner->second.empty()){
+				const std::vector<uint8_t> &im = inner->second;
+				for(int i = 0; i < f.size; i++){
+					mask[f.offset + i] |= im[i % im.size()];
+				}
+			} else {
+				memset(&mask[f.offset], 0xff, f.size);
+			}
+		}
+
+		size_t known = std::count(mask.begin(), mask.end(), 0xff);
+		fprintf(fh, "\n/** %s: %zu of %d bytes known */\n"
+			"static const uint8_t struct_mask_%s[%d] = {",
+			rs.name, known, rs.size, rs.name, rs.size);
+		for(int i = 0; i < rs.size; i++){
+			fprintf(fh, "%s%s", (i % 16 == 0) ? "\n  " : " ", mask[i] ? "0xff," : "0,");
+		}
+		fprintf(fh, "\n};\n");
+
+		if(rs.size <= STRUCT_SMALL_SIZE){
+			write_small_mask(fh, rs, mask);
+			continue;
+		}
+		fprintf(fh, "static inline uint64_t struct_hash_%s(const %s *p){\n"
+			"  return struct_hash_masked(p, struct_mask_%s, %d);\n"
+			"}\n"
+			"static inline int struct_equal_%s(const %s *a, const %s *b){\n"
+			"  return struct_equal_masked(a, b, struct_mask_%s, %d);\n"
+			"}\n"
+			"static inline void struct_hash_n_%s(uint64_t *out, const %s *p, size_t count){\n"
+			"  struct_hash_n_masked(out, p, struct_mask_%s, %d, count);\n"
+			"}\n"
+			"static inline size_t struct_find_%s(const %s *key, const %s *p, size_t count){\n"
+			"  return struct_find_masked(key, p, struct_mask_%s, %d, count);\n"
+			"}\n",
+			rs.name, rs.name, rs.name, rs.size,
+			rs.name, rs.name, rs.name, rs.name, rs.size,
+			rs.name, rs.name, rs.name, rs.size,
+			rs.name, rs.name, rs.name, rs.name, rs.size);
+	}
+}
+
+ssize_t handle_soa(struct __meta_soa *soa){
+	if(!soa->name || !soa->fields) return -1;
+
+	soa_request req = { soa->name };
+	// "foo, bar" -> { "foo", "bar" }
+	for(const char *p = soa->fields; *p;){
+		while(*p == ' ' || *p == ',') p++;
+		const char *begin = p;
+		while(*p && *p != ',' && *p != ' ') p++;
+		if(p > begin) req.fields.push_back(std::string(begin, p - begin));
+	}
+	soa_requests.push_back(req);
+	return sizeof(*soa);
+}
+
+static const resolved_struct *find_resolved_struct(const char *name){
+	for(const resolved_struct &rs : resolved_structs){
+		if(!strcmp(rs.name, name)) return &rs;
+	}
+	return NULL;
+}
+
+/**
+ * @brief
+ * emits, for each META_STRUCT_SOA, a struct-of-arrays view of the struct
+ * together with the bulk AoS <-> SoA copy routines (see target/soa.h)
+ */
+static bool write_soa(FILE *fh){
+	fprintf(fh, "/** generated by metadata -out-soa */\n"
+		"#pragma once\n"
+		"#include \"soa.h\"\n");
+
+	for(const soa_request &req : soa_requests){
+		const resolved_struct *rs = find_resolved_struct(req.name);
+		if(!rs){
+			DEBUG("ERROR: SoA for unknown struct %s\n", req.name);
+			return false;
+		}
+		std::vector<const struct __meta_struct_field *> fields;
+		for(const std::string &name : req.fields){
+			const struct __meta_struct_field *found = NULL;
+			for(const struct __meta_struct_field &f : rs->fields){
+				if(name == f.name) found = &f;
+			}
+			if(!found || found->decl || found->size < 1){
+				DEBUG("ERROR: can't make a SoA of %s::%s (unknown, sized 0, or array)\n",
+					req.name, name.c_str());
+				return false;
+			}
+			fields.push_back(found);
+		}
+
+		fprintf(fh, "\n/** struct-of-arrays view of %s */\n"
+			"typedef struct %s_soa {\n", rs->name, rs->name);
+		for(const struct __meta_struct_field *f : fields){
+			fprintf(fh, "  %s *%s; ///< offset=0x%x\n", f->type, f->name, f->offset);
+		}
+		fprintf(fh, "} %s_soa;\n", rs->name);
+
+		// with a vector gather, fields are copied one block of records at a time, so that the records stay in cache.
+		// without it, a single pass with typed loads is faster than the element-wise copies of soa_gather
+		fprintf(fh, "\n/** AoS -> SoA: copies the fields of `count` records to the arrays of `soa` */\n"
+			"static inline void %s_soa_gather(const %s_soa *soa, const %s *aos, size_t count){\n"
+			"#ifdef SOA_VECTOR_GATHER\n"
+			"  for(size_t i = 0; i < count; i += SOA_BLOCK){\n"
+			"    size_t n = (count - i < SOA_BLOCK) ? count - i : SOA_BLOCK;\n",
+			rs->name, rs->name, rs->name);
+		for(const struct __meta_struct_field *f : fields){
+			fprintf(fh, "    soa_gather(soa->%s + i, aos + i, %d, %d, %d, n);\n",
+				f->name, rs->size, f->offset, f->size);
+		}
+		// the arrays are read once, or each store could alias `soa` and force a reload
+		fprintf(fh, "  }\n"
+			"#else\n");
+		for(const struct __meta_struct_field *f : fields){
+			fprintf(fh, "  %s *__%s = soa->%s;\n", f->type, f->name, f->name);
+		}
+		fprintf(fh, "  for(size_t i = 0; i < count; i++){\n");
+		for(const struct __meta_struct_field *f : fields){
+			fprintf(fh, "    __%s[i] = aos[i].%s;\n", f->name, f->name);
+		}
+		fprintf(fh, "  }\n"
+			"#endif\n"
+			"}\n");
+
+		fprintf(fh, "\n/** SoA -> AoS: writes the arrays of `soa` back to `count` records */\n"
+			"static inline void %s_soa_scatter(%s *aos, const %s_soa *soa, size_t count){\n"
+			"  for(size_t i = 0; i < count; i += SOA_BLOCK){\n"
+			"    size_t n = (count - i < SOA_BLOCK) ? count - i : SOA_BLOCK;\n",
+			rs->name, rs->name, rs->name);
+		for(const struct __meta_struct_field *f : fields){
+			fprintf(fh, "    soa_scatter(aos + i, soa->%s + i, %d, %d, %d, n);\n",
+				f->name, rs->size, f->offset, f->size);
+		}
+		fprintf(fh, "  }\n"
+			"}\n");
+	}
+	return true;
+}
+
+ssize_t handle_capture(struct __meta_capture *cap){
+	if(!cap->name) return -1;
+	capture_requests.push_back(cap->name);
+	return sizeof(*cap);
+}
+
+struct capture_arg {
+	std::string type;
+	std::string name;
+	/** for pointers to metadata structs, whose contents are captured too */
+	const resolved_struct *pointee;
+};
+
+static std::string trim(const std::string &s){
+	size_t begin = s.find_first_not_of(" \t");
+	if(begin == std::string::npos) return std::string();
+	size_t end = s.find_last_not_of(" \t");
+	return s.substr(begin, end - begin + 1);
+}
+
+/**
+ * @brief splits "int a, sample_struct *b" into the capturable arguments
+ * @return an error message, or NULL on success
+ */
+static const char *parse_capture_args(const char *arg_types, std::vector<capture_arg> &args){
+	std::string all = trim(arg_types);
+	if(all.empty() || all == "void") return NULL;
+	if(all.find_first_of("([") != std::string::npos) return "function pointer or array argument";
+	if(all.find("...") != std::string::npos) return "variadic function";
+
+	size_t begin = 0;
+	while(begin <= all.size()){
+		size_t comma = all.find(',', begin);
+		if(comma == std::string::npos) comma = all.size();
+		std::string part = trim(all.substr(begin, comma - begin));
+		begin = comma + 1;
+
+		size_t name_begin = part.size();
+		while(name_begin > 0 && (isalnum((unsigned char)part[name_begin - 1]) || part[name_begin - 1] == '_')){
+			name_begin--;
+		}
+		capture_arg arg = { trim(part.substr(0, name_begin)), part.substr(name_begin), NULL };
+		if(arg.type.empty() || arg.name.empty()) return "unnamed argument";
+
+		size_t stars = std::count(arg.type.begin(), arg.type.end(), '*');
+		if(stars > 1) return "pointer to pointer argument";
+		if(stars == 1){
+			std::string base = trim(arg.type.substr(0, arg.type.find('*')));
+			static const char *qualifiers[] = { "const ", "volatile ", "struct " };
+			for(const char *q : qualifiers){
+				if(!base.compare(0, strlen(q), q)) base = trim(base.substr(strlen(q)));
+			}
+			arg.pointee = find_resolved_struct(base.c_str());
+			if(!arg.pointee || arg.pointee->size < 1) return "pointer to a non-metadata type";
+		}
+		args.push_back(arg);
+	}
+	return NULL;
+}
+
+/**
+ * @brief drops the top-level cv-qualifiers of an argument type, so that the replay local can be written.
+ * "const int" -> "int", "const sample_struct *const" -> "const sample_struct *"
+ */
+static std::string replay_local_type(const std::string &type){
+	// for pointers, only the qualifiers after the '*' apply to the local itself
+	size_t star = type.rfind('*');
+	size_t begin = (star == std::string::npos) ? 0 : star + 1;
+	std::string out = type.substr(0, begin);
+	size_t i = begin;
+	while(i < type.size()){
+		if(!isalnum((unsigned char)type[i]) && type[i] != '_'){
+			out += type[i++];
+			continue;
+		}
+		size_t end = i;
+		while(end < type.size() && (isalnum((unsigned char)type[end]) || type[end] == '_')) end++;
+		std::string word = type.substr(i, end - i);
+		if(word != "const" && word != "volatile") out += word;
+		i = end;
+	}
+	out = trim(out);
+	// keep "T *" so the name can follow directly
+	if(star != std::string::npos) out = trim(out.substr(0, out.rfind('*'))) + " *";
+	return out;
+}
+
+static uint32_t capture_id(const char *name){
+	// FNV-1a
+	uint32_t hash = 0x811c9dc5;
+	for(const char *p = name; *p; p++){
+		hash = (hash ^ (uint8_t)*p) * 0x01000193;
+	}
+	return hash;
+}
+
+/**
+ * @brief
+ * emits, for each META_FUNCTION_CAPTURE, a stub that records the arguments
+ * (and the pointed-to metadata structs) and one that replays them (see target/capture.h).
+ * functions that can't be captured are skipped with a warning, and their CAPTURE_CALL() does nothing
+ * @return false if two functions have the same capture id
+ */
+static bool write_capture(FILE *fh){
+	fprintf(fh, "/** generated by metadata -out-capture, included by capture.h */\n"
+		"#pragma once\n");
+
+	std::vector<const char *> emitted;
+	std::unordered_map<uint32_t, const char *> ids;
+	for(const char *name : capture_requests){
+		uint32_t id = capture_id(name);
+		auto same_id = ids.find(id);
+		if(same_id != ids.end()){
+			if(!strcmp(same_id->second, name)) continue;
+			fprintf(stderr, "ERROR: capture id 0x%08x of %s collides with %s, rename one of them\n",
+				id, name, same_id->second);
+			return false;
+		}
+		ids[id] = name;
+
+		auto it = function_items.find(name);
+		struct __meta_function_item *ref = (it != function_items.end()) ? it->second : NULL;
+		std::vector<capture_arg> args;
+		const char *error = (!ref) ? "unknown function"
+			: (!ref->ret_type || !ref->arg_types) ? "missing prototype"
+			: parse_capture_args(ref->arg_types, args);
+		if(error){
+			fprintf(stderr, "WARNING: not capturing %s: %s\n", name, error);
+			fprintf(fh, "\n/* %s can't be captured: %s */\n"
+				"#define __capture_%s(...) ((void)0)\n", name, error, name);
+			continue;
+		}
+
+		fprintf(fh, "\n#define CAPTURE_ID_%s 0x%08xu\n", name, id);
+
+		fprintf(fh, "static inline void __capture_%s(%s){\n"
+			"  struct capture_writer *w = capture_begin(CAPTURE_ID_%s);\n"
+			"  if(!w) return;\n", name, ref->arg_types, name);
+		for(const capture_arg &arg : args){
+			if(arg.pointee){
+				fprintf(fh, "  capture_write_pointee(w, %s, %d);\n", arg.name.c_str(), arg.pointee->size);
+			} else {
+				fprintf(fh, "  capture_write(w, &%s, sizeof(%s));\n", arg.name.c_str(), arg.name.c_str());
+			}
+		}
+		fprintf(fh, "  capture_end(w);\n"
+			"}\n");
+
+		fprintf(fh, "static inline void __replay_%s(struct capture_reader *r, int call){\n", name);
+		for(const capture_arg &arg : args){
+			std::string type = replay_local_type(arg.type);
+			if(arg.pointee){
+				fprintf(fh, "  %s __buf_%s;\n"
+					"  %s%s = NULL;\n",
+					arg.pointee->name, arg.name.c_str(), type.c_str(), arg.name.c_str());
+			} else {
+				fprintf(fh, "  %s %s;\n", type.c_str(), arg.name.c_str());
+			}
+		}
+		for(const capture_arg &arg : args){
+			if(arg.pointee){
+				fprintf(fh, "  if(capture_read_pointee(r, &__buf_%s, %d)) %s = &__buf_%s;\n",
+					arg.name.c_str(), arg.pointee->size, arg.name.c_str(), arg.name.c_str());
+			} else {
+				fprintf(fh, "  capture_read(r, &%s, sizeof(%s));\n", arg.name.c_str(), arg.name.c_str());
+			}
+		}
+		fprintf(fh, "  if(call) (void)%s(", name);
+		for(size_t i = 0; i < args.size(); i++){
+			fprintf(fh, "%s%s", (i > 0) ? ", " : "", args[i].name.c_str());
+		}
+		fprintf(fh, ");\n"
+			"}\n");
+		emitted.push_back(name);
+	}
+
+	fprintf(fh, "\n#ifdef CAPTURE_REPLAY_TABLE\n"
+		"static const struct capture_replay capture_replays[] = {\n");
+	for(const char *name : emitted){
+		fprintf(fh, "  { CAPTURE_ID_%s, \"%s\", __replay_%s },\n", name, name, name);
+	}
+	fprintf(fh, "  { 0, NULL, NULL }\n"
+		"};\n"
+		"#endif\n");
+	return true;
+}
+
+/** hits per field of each struct type, read from a heatmap profile (-shadow-profile) */
+static std::unordered_map<std::string, std::unordered_map<std::string, unsigned long>> shadow_profile;
+
+#define SHADOW_LINE_SIZE 64
+
+/** reads the "fields" object of a heatmap entry */
+static bool json_field_hits(json_reader *r, std::unordered_map<std::string, unsigned long> &hits){
+	if(!json_expect(r, '{')) return false;
+	if(json_peek(r, '}')) return json_expect(r, '}');
+	do {
+		std::string_view name;
+		long n;
+		if(!json_string(r, &name) || !json_expect(r, ':') || !json_number(r, &n)) return false;
+		hits[std::string(name)] += n;
+	} while(json_peek(r, ',') && ++r->p);
+	return json_expect(r, '}');
+}
+
+/**
+ * @brief
+ * loads the output of heatmap_dump. the hits of all the objects of the same type are summed
+ * @return false if the file can't be read or parsed
+ */
+static bool load_shadow_profile(const char *path){
+	FILE *fh = fopen(path, "rb");
+	if(!fh){
+		fprintf(stderr, "Failed to open profile '%s'\n", path);
+		return false;
+	}
+	std::string buf;
+	char chunk[4096];
+	size_t n;
+	while((n = fread(chunk, 1, sizeof(chunk), fh)) > 0) buf.append(chunk, n);
+	fclose(fh);
+
+	json_reader r = { buf.c_str(), buf.c_str() + buf.size(), NULL };
+	bool ok = json_expect(&r, '[');
+	if(ok && json_peek(&r, ']')) return json_expect(&r, ']');
+	while(ok){
+		std::string_view type;
+		std::unordered_map<std::string, unsigned long> hits;
+		ok = json_expect(&r, '{');
+		if(ok && !json_peek(&r, '}')){
+			do {
+				std::string_view key;
+				ok = json_string(&r, &key) && json_expect(&r, ':');
+				if(!ok) break;
+				if(key == "type") ok = json_string(&r, &type);
+				else if(key == "fields") ok = json_field_hits(&r, hits);
+				else ok = json_skip(&r);
+			} while(ok && json_peek(&r, ',') && ++r.p);
+		}
+		ok = ok && json_expect(&r, '}');
+		if(!ok) break;
+		for(auto &h : hits){
+			shadow_profile[std::string(type)][h.first] += h.second;
+		}
+		if(!json_peek(&r, ',')) break;
+		++r.p;
+	}
+	if(ok) ok = json_expect(&r, ']');
+	if(!ok){
+		fprintf(stderr, "Invalid profile '%s' at byte %zu\n",
+			path, (size_t)((r.error ? r.error : r.p) - buf.c_str()));
+	}
+	return ok;
+}
+
+/**
+ * @brief natural alignment of a field, estimated from the size of its elements.
+ * metadata structs are packed, so they don't need any
+ */
+static int field_alignment(const struct __meta_struct_field &f){
+	std::string type = (f.type) ? f.type : "";
+	size_t bracket = type.find('[');
+	if(find_resolved_struct(trim(type.substr(0, bracket)).c_str())) return 1;
+
+	int count = 1;
+	for(size_t p = bracket; p != std::string::npos; p = type.find('[', p + 1)){
+		count *= atoi(type.c_str() + p + 1);
+	}
+	int elem_size = (count > 0) ? f.size / count : f.size;
+	int align = 1;
+	while(align < 8 && elem_size % (align * 2) == 0) align *= 2;
+	return align;
+}
+
+static int cache_lines(int offset, int size){
+	return (size > 0) ? (offset + size - 1) / SHADOW_LINE_SIZE - offset / SHADOW_LINE_SIZE + 1 : 0;
+}
+
+/** number of distinct cache lines touched by the given [offset, offset + size) ranges */
+static int cache_lines_touched(std::vector<std::pair<int, int>> ranges){
+	std::vector<int> lines;
+	for(const std::pair<int, int> &r : ranges){
+		for(int i = 0; i < cache_lines(r.first, r.second); i++){
+			lines.push_back(r.first / SHADOW_LINE_SIZE + i);
+		}
+	}
+	std::sort(lines.begin(), lines.end());
+	return std::unique(lines.begin(), lines.end()) - lines.begin();
+}
+
+struct shadow_field {
+	const struct __meta_struct_field *f;
+	int align;
+	unsigned long hits;
+	bool hot;
+	/** estimated offset in the shadow struct */
+	int offset;
+};
+
+/**
+ * @brief
+ * emits, for each struct, a naturally aligned "shadow" with the fields reordered
+ * (hot fields first, then by decreasing alignment), together with the routines that
+ * convert from and to the original layout. fields are hot if they have hits in the profile,
+ * or all of them, for structs that aren't profiled.
+ * the report compares the cache lines touched by the hot fields in either layout,
+ * for objects starting at a cache line boundary
+ */
+static void write_shadow(FILE *fh, FILE *report){
+	if(fh){
+		fprintf(fh, "/** generated by metadata -out-shadow */\n"
+			"#pragma once\n"
+			"#include <stddef.h>\n"
+			"#include <stdint.h>\n"
+			"#include <string.h>\n");
+	}
+	if(report){
+		fprintf(report, "{\n"
+			"  \"line_size\": %d,\n"
+			"  \"structs\": [", SHADOW_LINE_SIZE);
+	}
+
+	int total_hot_lines = 0;
+	int total_shadow_hot_lines = 0;
+	bool first = true;
+	for(const resolved_struct &rs : resolved_structs){
+		if(rs.size <= 0 || rs.fields.empty()) continue;
+
+		const char *skip = NULL;
+		int prev_end = 0;
+		for(const struct __meta_struct_field &f : rs.fields){
+			if(f.size < 1) skip = "flexible or unsized field";
+			else if(f.offset < prev_end) skip = "overlapping fields";
+			prev_end = f.offset + f.size;
+		}
+		if(skip){
+			if(fh) fprintf(fh, "\n/** %s: no shadow (%s) */\n", rs.name, skip);
+			continue;
+		}
+
+		auto profile = shadow_profile.find(rs.name);
+		bool profiled = profile != shadow_profile.end();
+
+		std::vector<shadow_field> fields;
+		for(const struct __meta_struct_field &f : rs.fields){
+			shadow_field sf = { &f, field_alignment(f), 0, !profiled, 0 };
+			if(profiled){
+				auto hits = profile->second.find(f.name);
+				if(hits != profile->second.end()) sf.hits = hits->second;
+				sf.hot = sf.hits > 0;
+			}
+			fields.push_back(sf);
+		}
+		// stable: fields that compare equal keep the original order
+		std::stable_sort(fields.begin(), fields.end(), [](const shadow_field &a, const shadow_field &b){
+			if(a.hot != b.hot) return a.hot;
+			if(a.align != b.align) return a.align > b.align;
+			return a.hits > b.hits;
+		});
+
+		int size = 0;
+		int max_align = 1;
+		std::vector<std::pair<int, int>> hot_ranges, shadow_hot_ranges;
+		for(shadow_field &sf : fields){
+			size = (size + sf.align - 1) / sf.align * sf.align;
+			sf.offset = size;
+			size += sf.f->size;
+			max_align = std::max(max_align, sf.align);
+			if(sf.hot){
+				hot_ranges.push_back({ sf.f->offset, sf.f->size });
+				shadow_hot_ranges.push_back({ sf.offset, sf.f->size });
+			}
+		}
+		size = (size + max_align - 1) / max_align * max_align;
+
+		int hot_lines = cache_lines_touched(hot_ranges);
+		int shadow_hot_lines = cache_lines_touched(shadow_hot_ranges);
+		total_hot_lines += hot_lines;
+		total_shadow_hot_lines += shadow_hot_lines;
+
+		if(report){
+			fprintf(report, "%s\n    {\n"
+				"      \"name\": \"%s\",\n"
+				"      \"profiled\": %s,\n"
+				"      \"size\": %d,\n"
+				"      \"shadow_size\": %d,\n"
+				"      \"lines\": %d,\n"
+				"      \"shadow_lines\": %d,\n"
+				"      \"hot_fields\": %zu,\n"
+				"      \"hot_lines\": %d,\n"
+				"      \"shadow_hot_lines\": %d\n"
+				"    }",
+				(first) ? "" : ",",
+				rs.name, (profiled) ? "true" : "false",
+				rs.size, size,
+				cache_lines(0, rs.size), cache_lines(0, size),
+				hot_ranges.size(), hot_lines, shadow_hot_lines);
+			first = false;
+		}
+		if(!fh) continue;
+
+		fprintf(fh, "\n/**\n"
+			" * @brief shadow of %s: ~%d bytes (%d packed),\n"
+			" * hot fields in %d cache line(s) (%d in the original)\n"
+			" */\n"
+			"typedef struct %s_shadow {\n",
+			rs.name, size, rs.size, shadow_hot_lines, hot_lines, rs.name);
+		for(const shadow_field &sf : fields){
+			const struct __meta_struct_field *f = sf.f;
+			fprintf(fh, "  %s%s%s; ///< original offset=0x%x",
+				(f->decl) ? f->decl : f->type,
+				(f->decl) ? "" : " ",
+				(f->decl) ? "" : f->name,
+				f->offset);
+			if(profiled) fprintf(fh, ", hits=%lu", sf.hits);
+			fprintf(fh, "\n");
+		}
+		fprintf(fh, "} %s_shadow;\n", rs.name);
+
+		// the original is only accessed through offsets, as its fields can be unaligned
+		fprintf(fh, "\n/** copies the known fields of `src` to `dst` */\n"
+			"static inline void %s_to_shadow(%s_shadow *dst, const %s *src){\n",
+			rs.name, rs.name, rs.name);
+		for(const shadow_field &sf : fields){
+			fprintf(fh, "  INLINE_MEMCPY(&dst->%s, (const uint8_t *)src + 0x%x, %d);\n",
+				sf.f->name, sf.f->offset, sf.f->size);
+		}
+		fprintf(fh, "}\n"
+			"\n/** writes the fields of `src` back to `dst`. the padding of `dst` is left as it is */\n"
+			"static inline void %s_from_shadow(%s *dst, const %s_shadow *src){\n",
+			rs.name, rs.name, rs.name);
+		for(const shadow_field &sf : fields){
+			fprintf(fh, "  INLINE_MEMCPY((uint8_t *)dst + 0x%x, &src->%s, %d);\n",
+				sf.f->offset, sf.f->name, sf.f->size);
+		}
+		fprintf(fh, "}\n"
+			"static inline void %s_to_shadow_n(%s_shadow *dst, const %s *src, size_t count){\n"
+			"  for(size_t i = 0; i < count; i++) %s_to_shadow(&dst[i], &src[i]);\n"
+			"}\n"
+			"static inline void %s_from_shadow_n(%s *dst, const %s_shadow *src, size_t count){\n"
+			"  for(size_t i = 0; i < count; i++) %s_from_shadow(&dst[i], &src[i]);\n"
+			"}\n",
+			rs.name, rs.name, rs.name, rs.name,
+			rs.name, rs.name, rs.name, rs.name);
+	}
+
+	if(report){
+		fprintf(report, "\n  ],\n"
+			"  \"hot_lines\": %d,\n"
+			"  \"shadow_hot_lines\": %d,\n"
+			"  \"lines_saved\": %d\n"
+			"}\n",
+			total_hot_lines, total_shadow_hot_lines, total_hot_lines - total_shadow_hot_lines);
+	}
+}
+
+static void write_stats(FILE *fh){
+	fprintf(fh, "{\n"
+		"  \"items\": {\n"
+		"    \"function\": %u,\n"
+		"    \"data\": %u,\n"
+		"    \"struct\": %u,\n"
+		"    \"soa\": %u,\n"
+		"    \"capture\": %u\n"
+		"  },\n"
+		"  \"fields\": %u,\n"
+		"  \"padding_bytes\": %u,\n"
+		"  \"update_struct_size\": {\n"
+		"    \"calls\": %u,\n"
+		"    \"max_depth\": %u\n"
+		"  },\n"
+		"  \"time\": {\n"
+		"    \"section_copy\": %.6f,\n"
+		"    \"struct_resolution\": %.6f,\n"
+		"    \"header\": %.6f,\n"
+		"    \"json\": %.6f,\n"
+		"    \"outputs\": %.6f,\n"
+		"    \"total\": %.6f\n"
+		"  }\n"
+		"}\n",
+		stats.num_items[META_FREF],
+		stats.num_items[META_DREF],
+		stats.num_items[META_STRUCT],
+		stats.num_items[META_SOA],
+		stats.num_items[META_CAPTURE],
+		stats.num_fields,
+		stats.padding_bytes,
+		stats.update_struct_size_calls,
+		stats.update_struct_size_max_depth,
+		stats.time_section_copy,
+		stats.time_resolve,
+		stats.time_header,
+		stats.time_json,
+		stats.time_outputs,
+		stats.time_total
+	);
+}
+
+/**
+ * @brief
+ * reads the strings that follow the fixed part of a compact record
+ * @return false if they don't fit in the record
+ */
+static bool compact_strings(const uint8_t *rec, size_t fixed_size, const char **strs, int count){
+	struct __meta_compact_item item;
+	memcpy(&item, rec, sizeof(item));
+	const char *p = (const char *)rec + fixed_size;
+	const char *rec_end = (const char *)rec + item.size;
+	for(int i = 0; i < count; i++){
+		const char *nul = (p < rec_end) ? (const char *)memchr(p, '\0', rec_end - p) : NULL;
+		if(!nul) return false;
+		strs[i] = p;
+		p = nul + 1;
+	}
+	return true;
+}
+
+template <typename T>
+static void append_record(std::vector<uint8_t> &out, const T &rec){
+	const uint8_t *p = (const uint8_t *)&rec;
+	out.insert(out.end(), p, p + sizeof(rec));
+}
+
+/**
+ * @brief
+ * converts the compact records (META_COMPACT) in [start, end) to regular ones.
+ * regular records are copied as they are, so both encodings can be mixed.
+ * the strings still point into [start, end)
+ * @return false if the records are malformed, or of an unsupported version
+ */
+static bool expand_compact(uint8_t *start, uint8_t *end, std::vector<uint8_t> &out){
+	int version = 0;
+	bool in_struct = false;
+	out.reserve((end - start) * 2);
+
+	uint8_t *p = start;
+	while(p + sizeof(enum __meta_item_type) <= end){
+		enum __meta_item_type type = *(enum __meta_item_type *)p;
+		if(type < META_COMPACT_VERSION){
+			size_t size = 0;
+			switch(type){
+			case META_FREF: size = sizeof(struct __meta_function_item); break;
+			case META_DREF: size = sizeof(struct __meta_data_item); break;
+			case META_SOA: size = sizeof(struct __meta_soa); break;
+			case META_CAPTURE: size = sizeof(struct __meta_capture); break;
+			case META_STRUCT: {
+				struct __meta_struct_field *f = ((struct __meta_struct *)p)->fields;
+				while((uint8_t *)(f + 1) <= end && !IS_END_FIELD(f)) f++;
+				size = (uint8_t *)(f + 1) - p;
+				break;
+			}
+			default: break;
+			}
+			if(in_struct || size == 0 || p + size > end) break;
+			out.insert(out.end(), p, p + size);
+			p += size;
+			continue;
+		}
+
+		struct __meta_compact_item item;
+		if(p + sizeof(item) > end) break;
+		memcpy(&item, p, sizeof(item));
+		if(item.size < sizeof(item) || p + item.size > end){
+			DEBUG("ERROR: truncated compact record %d\n", type);
+			return false;
+		}
+		if(type != META_COMPACT_VERSION && version == 0){
+			DEBUG("ERROR: compact record %d without a version header\n", type);
+			return false;
+		}
+		if(in_struct != (type == META_COMPACT_FIELD)){
+			DEBUG("ERROR: compact record %d %s a struct\n", type, in_struct ? "inside" : "outside");
+			return false;
+		}
+
+		const char *strs[4];
+		bool valid = true;
+		switch(type){
+		case META_COMPACT_VERSION: {
+			struct __meta_compact_version rec;
+			if(item.size < sizeof(rec)) return false;
+			memcpy(&rec, p, sizeof(rec));
+			if(rec.version != META_COMPACT_VERSION_NUMBER){
+				DEBUG("ERROR: unsupported compact metadata version %d (expected %d)\n",
+					rec.version, META_COMPACT_VERSION_NUMBER);
+				return false;
+			}
+			version = rec.version;
+			break;
+		}
+		case META_COMPACT_FREF: {
+			struct __meta_compact_function rec;
+			memcpy(&rec, p, sizeof(rec));
+			if(!(valid = compact_strings(p, sizeof(rec), strs, 4))) break;
+			struct __meta_function_item ref = {
+				META_FREF, rec.orig_addr, strs[0], strs[1], strs[2], strs[3], rec.stack_bytes
+			};
+			append_record(out, ref);
+			break;
+		}
+		case META_COMPACT_DREF: {
+			struct __meta_compact_data rec;
+			memcpy(&rec, p, sizeof(rec));
+			if(!(valid = compact_strings(p, sizeof(rec), strs, 2))) break;
+			struct __meta_data_item ref = { META_DREF, rec.orig_addr, strs[0], strs[1] };
+			append_record(out, ref);
+			break;
+		}
+		case META_COMPACT_STRUCT: {
+			struct __meta_compact_struct rec;
+			memcpy(&rec, p, sizeof(rec));
+			if(!(valid = compact_strings(p, sizeof(rec), strs, 1))) break;
+			struct __meta_struct st;
+			st.item_type = META_STRUCT;
+			st.name = strs[0];
+			st.size = rec.size;
+			append_record(out, st);
+			in_struct = true;
+			break;
+		}
+		case META_COMPACT_FIELD: {
+			struct __meta_compact_field rec;
+			memcpy(&rec, p, sizeof(rec));
+			if(!(valid = compact_strings(p, sizeof(rec), strs, 3))) break;
+			struct __meta_struct_field f = { 0, 0, 0, rec.offset, rec.size };
+			if(IS_END_FIELD(&f)){
+				in_struct = false;
+			} else {
+				f.name = strs[0];
+				f.type = strs[1];
+				f.decl = (*strs[2]) ? strs[2] : NULL;
+			}
+			append_record(out, f);
+			break;
+		}
+		case META_COMPACT_SOA: {
+			if(!(valid = compact_strings(p, sizeof(item), strs, 2))) break;
+			struct __meta_soa soa = { META_SOA, strs[0], strs[1] };
+			append_record(out, soa);
+			break;
+		}
+		case META_COMPACT_CAPTURE: {
+			if(!(valid = compact_strings(p, sizeof(item), strs, 1))) break;
+			struct __meta_capture cap = { META_CAPTURE, strs[0] };
+			append_record(out, cap);
+			break;
+		}
+		default:
+			DEBUG("ERROR: unknown compact record %d\n", type);
+			return false;
+		}
+		if(!valid){
+			DEBUG("ERROR: malformed compact record %d\n", type);
+			return false;
+		}
+		p += item.size;
+	}
+	if(in_struct){
+		DEBUG("ERROR: unterminated compact struct\n");
+		return false;
+	}
+	return true;
+}
+
+/**
+ * @brief
+ * converts the metadata items in [start, end) to the outputs
+ */
+static int process_items(uint8_t *start, uint8_t *end, double t_start)
+{
+  struct_pointers.clear();
+  resolved_structs.clear();
+  soa_requests.clear();
+  capture_requests.clear();
+  function_items.clear();
 
   if(gen_types){
     OUT_HDR("#include <stddef.h>\n"
@@ -469,18 +1500,21 @@ int main(int argc, const char **argv, const char **envp)
 
   bool cont = true;
   bool emitted = false;
-  int exitCode = 0;
 
   for (; start < end && cont;) {
+    enum __meta_item_type type = *(enum __meta_item_type *)start;
     if (json_first)
       json_first = false;
-    else if (emitted) {
+    else if (emitted && type != META_SOA && type != META_CAPTURE) {
+      // requests have no JSON form, the separator goes before the next item
       OUT_JSON(",");
       emitted = false;
     }
-    enum __meta_item_type type = *(enum __meta_item_type *)start;
 
     ssize_t size = 0;
+    // one timer per item, charged to the output the item goes to
+    double t_item = now_seconds();
+    double resolve_before = stats.time_resolve;
     switch (type) {
     case META_FREF:
       size = handle_func_ref((struct __meta_function_item *)start);
@@ -494,20 +1528,282 @@ int main(int argc, const char **argv, const char **envp)
       size = handle_struct((struct __meta_struct *)start);
       emitted = size > 0 && gen_types;
       break;
+    case META_SOA:
+      size = handle_soa((struct __meta_soa *)start);
+      break;
+    case META_CAPTURE:
+      size = handle_capture((struct __meta_capture *)start);
+      break;
     default:
       cont = false;
       break;
     }
     if (cont && size <= 0) {
       DEBUG("Error while handling meta item %d\n", type);
-      exitCode = 1;
-      goto end;
+      return 1;
+    }
+    if (cont) {
+      ++stats.num_items[type];
+      double elapsed = now_seconds() - t_item;
+      if (type == META_STRUCT)
+        stats.time_header += elapsed - (stats.time_resolve - resolve_before);
+      else if (type == META_FREF || type == META_DREF)
+        stats.time_json += elapsed;
     }
     start += size;
   }
   OUT_JSON("]\n");
 
+  double t_outputs = now_seconds();
+
+  if(fh_layout){
+    write_layouts(fh_layout);
+  }
+  if(fh_pool){
+    write_pool(fh_pool);
+  }
+  if(fh_mask){
+    write_masks(fh_mask);
+  }
+  if(fh_shadow || fh_shadow_report){
+    write_shadow(fh_shadow, fh_shadow_report);
+  }
+  if(fh_soa && !write_soa(fh_soa)){
+    return 1;
+  }
+  if(fh_capture && !write_capture(fh_capture)){
+    return 1;
+  }
+
+  stats.time_outputs = now_seconds() - t_outputs;
+
+  if(fh_stats){
+    stats.time_total = now_seconds() - t_start;
+    write_stats(fh_stats);
+  }
+  return 0;
+}
+
+static const char *out_hdr_filename = NULL;
+static const char *out_json_filename = NULL;
+static const char *out_layout_filename = NULL;
+static const char *out_soa_filename = NULL;
+static const char *out_capture_filename = NULL;
+static const char *out_pool_filename = NULL;
+static const char *out_mask_filename = NULL;
+static const char *out_shadow_filename = NULL;
+static const char *shadow_report_filename = NULL;
+static const char *shadow_profile_filename = NULL;
+static const char *stats_filename = NULL;
+
+static FILE *open_output(const char *filename, FILE *fallback){
+  if(!filename) return fallback;
+  FILE *out = fopen(filename, "w");
+  if (!out) {
+    fprintf(stderr, "Failed to open file '%s' for writing\n", filename);
+    return fallback;
+  }
+  return out;
+}
+
+struct memory_output {
+  const char *filename;
+  FILE **fh;
+  char *buf;
+  size_t size;
+};
+
+/**
+ * @brief replaces `filename` with the new contents, only if they differ
+ * (so that the dependent targets aren't rebuilt needlessly)
+ * @return true if the file was written
+ */
+static bool commit_output(const char *filename, const char *data, size_t size){
+  FILE *fh = fopen(filename, "rb");
+  if(fh){
+    bool same = false;
+    fseek(fh, 0, SEEK_END);
+    if((size_t)ftell(fh) == size){
+      std::string old(size, '\0');
+      fseek(fh, 0, SEEK_SET);
+      same = size == 0 || (fread(&old[0], size, 1, fh) == 1 && !memcmp(old.data(), data, size));
+    }
+    fclose(fh);
+    if(same) return false;
+  }
+  fh = fopen(filename, "wb");
+  if(!fh){
+    fprintf(stderr, "Failed to open file '%s' for writing\n", filename);
+    return false;
+  }
+  fwrite(data, size, 1, fh);
+  fclose(fh);
+  return true;
+}
+
+int regenerate(uint8_t *start, uint8_t *end){
+  // in watch mode, the outputs must be named
+  if(!out_hdr_filename || !out_json_filename){
+    fprintf(stderr, "watch mode requires -out-hdr and -out-json\n");
+    return 1;
+  }
+
+  double t_start = now_seconds();
+  memset(&stats, 0, sizeof(stats));
+
+  struct memory_output outputs[] = {
+    { out_hdr_filename, &fh_hdr },
+    { out_json_filename, &fh_json },
+    { out_layout_filename, &fh_layout },
+    { out_soa_filename, &fh_soa },
+    { out_capture_filename, &fh_capture },
+    { out_pool_filename, &fh_pool },
+    { out_mask_filename, &fh_mask },
+    { out_shadow_filename, &fh_shadow },
+    { shadow_report_filename, &fh_shadow_report },
+    { stats_filename, &fh_stats }
+  };
+  for(struct memory_output &o : outputs){
+    *o.fh = (o.filename) ? open_memstream(&o.buf, &o.size) : NULL;
+  }
+  int ret = process_items(start, end, t_start);
+  for(struct memory_output &o : outputs){
+    if(!*o.fh) continue;
+    fclose(*o.fh);
+    *o.fh = NULL;
+    if(ret == 0 && commit_output(o.filename, o.buf, o.size)){
+      DEBUG("updated %s\n", o.filename);
+    }
+    free(o.buf);
+  }
+  return ret;
+}
+
+int main(int argc, const char **argv, const char **envp)
+{
+  double t_start = now_seconds();
+
+  fh_json = stdout;
+  fh_hdr = stdout;
+  fh_debug = stderr;
+
+  setvbuf(fh_debug, NULL, _IONBF, 0);
+
+
+	uint8_t *start = metadata_begin();
+	uint8_t *end = metadata_end();
+	size_t metadata_length = end - start;
+
+	uint8_t *metadata_buffer = (uint8_t *)calloc(metadata_length, 1);
+	if(!metadata_buffer){
+		fprintf(stderr, "calloc(%zu) failed\n", metadata_length);
+		return EXIT_FAILURE;
+	}
+	memcpy(metadata_buffer, start, metadata_length);
+	stats.time_section_copy = now_seconds() - t_start;
+
+	start = metadata_buffer;
+	end = start + metadata_length;
+
+	// META_COMPACT build: the version record comes first
+	std::vector<uint8_t> expanded;
+	if(metadata_length >= sizeof(enum __meta_item_type)
+	&& *(enum __meta_item_type *)start == META_COMPACT_VERSION
+	){
+		if(!expand_compact(start, end, expanded)){
+			free(metadata_buffer);
+			return EXIT_FAILURE;
+		}
+		start = expanded.data();
+		end = start + expanded.size();
+		stats.time_section_copy = now_seconds() - t_start;
+	}
+
+  std::vector<const char *> watch_inputs;
+  for (int i = 1; i < argc;) {
+    const char *arg = argv[i++];
+    if (!strcmp(arg, "-data")) {
+      gen_data = true;
+      continue;
+    }
+    if (!strcmp(arg, "-code")) {
+      gen_code = true;
+      continue;
+    }
+    if (!strcmp(arg, "-types")) {
+      gen_types = true;
+      continue;
+    }
+    if (!strcmp(arg, "-out-hdr")) {
+      out_hdr_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-json")) {
+      out_json_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-layout")) {
+      out_layout_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-soa")) {
+      out_soa_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-capture")) {
+      out_capture_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-pool")) {
+      out_pool_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-mask")) {
+      out_mask_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-out-shadow")) {
+      out_shadow_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-shadow-report")) {
+      shadow_report_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-shadow-profile")) {
+      shadow_profile_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-stats")) {
+      stats_filename = argv[i++];
+    }
+    if (!strcmp(arg, "-watch")) {
+      watch_inputs.push_back(argv[i++]);
+    }
+  }
+
+  int exitCode = 0;
+  if(shadow_profile_filename && !load_shadow_profile(shadow_profile_filename)){
+    exitCode = 1;
+    goto end;
+  }
+  if(!watch_inputs.empty()){
+    exitCode = watch_main(watch_inputs.size(), watch_inputs.data(), start, end);
+    goto end;
+  }
+
+  fh_hdr = open_output(out_hdr_filename, fh_hdr);
+  fh_json = open_output(out_json_filename, fh_json);
+  fh_layout = open_output(out_layout_filename, NULL);
+  fh_soa = open_output(out_soa_filename, NULL);
+  fh_capture = open_output(out_capture_filename, NULL);
+  fh_pool = open_output(out_pool_filename, NULL);
+  fh_mask = open_output(out_mask_filename, NULL);
+  fh_shadow = open_output(out_shadow_filename, NULL);
+  fh_shadow_report = open_output(shadow_report_filename, NULL);
+  fh_stats = open_output(stats_filename, NULL);
+
+  exitCode = process_items(start, end, t_start);
+
 end:
+  dispose_fh(fh_stats);
+  dispose_fh(fh_layout);
+  dispose_fh(fh_soa);
+  dispose_fh(fh_capture);
+  dispose_fh(fh_pool);
+  dispose_fh(fh_mask);
+  dispose_fh(fh_shadow);
+  dispose_fh(fh_shadow_report);
   dispose_fh(fh_json);
   dispose_fh(fh_hdr);
   dispose_fh(fh_debug);
@@ -32,7 +32,17 @@
 enum __meta_item_type {
     META_FREF = 1,
     META_DREF,
-    META_STRUCT
+    META_STRUCT,
+    META_SOA,
+    META_CAPTURE,
+    /** compact encoding, see below */
+    META_COMPACT_VERSION,
+    META_COMPACT_FREF,
+    META_COMPACT_DREF,
+    META_COMPACT_STRUCT,
+    META_COMPACT_FIELD,
+    META_COMPACT_SOA,
+    META_COMPACT_CAPTURE
 };
 
 PACK(struct __meta_function_item {
@@ -67,6 +77,66 @@ PACK(struct __meta_struct {
     struct __meta_struct_field fields[];
 });
 
+/** request for a struct-of-arrays view of a struct */
+PACK(struct __meta_soa {
+    enum __meta_item_type item_type;
+    const char *name;
+    const char *fields;
+});
+
+/** request for argument capture/replay stubs of a function */
+PACK(struct __meta_capture {
+    enum __meta_item_type item_type;
+    const char *name;
+});
+
+/**
+ * @brief
+ * compact encoding, enabled with META_COMPACT.
+ * records hold no pointers (and so need no relocations) and have no exported symbol:
+ * the strings are stored NUL-terminated right after the fixed part, in declaration order.
+ * a struct is a META_COMPACT_STRUCT record followed by one META_COMPACT_FIELD per field,
+ * and by a terminating field with offset and size set to -1
+ */
+#define META_COMPACT_VERSION_NUMBER 2
+
+PACK(struct __meta_compact_item {
+    enum __meta_item_type item_type;
+    /** size of the whole record, strings included (32 bits, long prototypes can exceed 64KB) */
+    unsigned int size;
+});
+
+PACK(struct __meta_compact_version {
+    struct __meta_compact_item item;
+    unsigned short version;
+});
+
+/** strings: name, ret_type, arg_types, regs */
+PACK(struct __meta_compact_function {
+    struct __meta_compact_item item;
+    unsigned long orig_addr;
+    int stack_bytes;
+});
+
+/** strings: name, type */
+PACK(struct __meta_compact_data {
+    struct __meta_compact_item item;
+    unsigned long orig_addr;
+});
+
+/** strings: name */
+PACK(struct __meta_compact_struct {
+    struct __meta_compact_item item;
+    int size;
+});
+
+/** strings: name, type, decl (empty if none) */
+PACK(struct __meta_compact_field {
+    struct __meta_compact_item item;
+    int offset;
+    int size;
+});
+
 #ifdef _METADATA_INC
 /**
  * @brief 
@@ -108,6 +178,93 @@ PACK(struct __meta_struct {
     __attribute__ ((aligned (1)))
 #endif /** _MSC_VER */
 
+#define _META_CAT(a, b) a ## b
+#define _META_CAT2(a, b) _META_CAT(a, b)
+
+#ifdef META_COMPACT
+#ifdef _MSC_VER
+// the records are unreferenced: the metadata executable is linked with /OPT:NOREF (see metadata/CMakeLists.txt)
+#define META_COMPACT_DECL \
+    __declspec(allocate("metadata")) \
+    __declspec(align(1))
+#else
+#define META_COMPACT_DECL \
+    static \
+    __attribute__ ((used, section ("metadata"))) \
+    __attribute__ ((aligned (1)))
+#endif
+
+/** the version record comes first, as meta_types.h includes this file before any declaration */
+META_COMPACT_DECL struct __meta_compact_version __meta_compact_version = {
+    { META_COMPACT_VERSION, sizeof(struct __meta_compact_version) }, META_COMPACT_VERSION_NUMBER
+};
+
+#define DECLARE_META_FUNC(addr, name, ret_type, arg_types, regs, stack_bytes) \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_function item; \
+        char s0[sizeof(#name)]; char s1[sizeof(ret_type)]; char s2[sizeof(arg_types)]; char s3[sizeof(regs)]; \
+    }) __meta_ ## name = { \
+        { { META_COMPACT_FREF, sizeof(__meta_ ## name) }, addr, stack_bytes }, \
+        #name, ret_type, arg_types, regs }
+#define DECLARE_META_DATA(addr, name, type) \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_data item; \
+        char s0[sizeof(#name)]; char s1[sizeof(type)]; \
+    }) __meta_ ## name = { \
+        { { META_COMPACT_DREF, sizeof(__meta_ ## name) }, addr }, \
+        #name, type }
+
+#define _META_COMPACT_FIELD(var, offset, size, name, type, decl) \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_field item; \
+        char s0[sizeof(name)]; char s1[sizeof(type)]; char s2[sizeof(decl)]; \
+    }) var = { \
+        { { META_COMPACT_FIELD, sizeof(var) }, offset, size }, \
+        name, type, decl };
+// fields have no name of their own, number them
+#define _META_COMPACT_FIELD_N(n, offset, size, name, type, decl) \
+    _META_COMPACT_FIELD(_META_CAT2(__meta_field_, n), offset, size, name, type, decl)
+
+#define META_STRUCT_FIELD(offset, type, name) \
+    _META_COMPACT_FIELD_N(__COUNTER__, offset, sizeof(type), #name, #type, "")
+#define META_STRUCT_FIELD_ARRAY(offset, type, name, ...) \
+    _META_COMPACT_FIELD_N(__COUNTER__, offset, sizeof( type MAP(_ARRAY_DIMENSION, __VA_ARGS__) ), \
+        #name, \
+        #type MAP(_PRN_ARRAY_DIMENSION, __VA_ARGS__), \
+        #type " " #name MAP(_PRN_ARRAY_DIMENSION, __VA_ARGS__))
+#define META_STRUCT_FIELD_DECL(offset, decl, type, name) \
+    _META_COMPACT_FIELD_N(__COUNTER__, offset, sizeof(type), #name, #type, #decl)
+
+#define BEGIN_META_STRUCT(name, size) \
+    PACK(typedef struct { unsigned char __buffer[size]; }) name; \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_struct item; \
+        char s0[sizeof(#name)]; \
+    }) __meta_struct_ ## name = { \
+        { { META_COMPACT_STRUCT, sizeof(__meta_struct_ ## name) }, size }, \
+        #name };
+
+#define END_META_STRUCT(name) \
+    _META_COMPACT_FIELD_N(__COUNTER__, -1, -1, "", "", "")
+
+#define META_STRUCT_SOA(name, ...) \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_item item; \
+        char s0[sizeof(#name)]; char s1[sizeof(#__VA_ARGS__)]; \
+    }) __meta_soa_ ## name = { \
+        { META_COMPACT_SOA, sizeof(__meta_soa_ ## name) }, \
+        #name, #__VA_ARGS__ };
+
+#define META_FUNCTION_CAPTURE(name) \
+    META_COMPACT_DECL PACK(struct { \
+        struct __meta_compact_item item; \
+        char s0[sizeof(#name)]; \
+    }) __meta_capture_ ## name = { \
+        { META_COMPACT_CAPTURE, sizeof(__meta_capture_ ## name) }, \
+        #name };
+
+#else /** META_COMPACT */
+
 #define DECLARE_META_FUNC(addr, name, ret_type, arg_types, regs, stack_bytes) \
     META_DECL struct __meta_function_item __meta_ ## name = { META_FREF, addr, #name, ret_type, arg_types, regs, stack_bytes }
 #define DECLARE_META_DATA(addr, name, type) \
@@ -131,6 +288,14 @@ PACK(struct __meta_struct {
     { 0, 0, 0, -1, -1 } \
 }};
 
+#define META_STRUCT_SOA(name, ...) \
+    META_DECL struct __meta_soa __meta_soa_ ## name = { META_SOA, #name, #__VA_ARGS__ };
+
+#define META_FUNCTION_CAPTURE(name) \
+    META_DECL struct __meta_capture __meta_capture_ ## name = { META_CAPTURE, #name };
+
+#endif /** META_COMPACT */
+
 #else /** _METADATA_INC */
 
 #define DECLARE_META_FUNC(addr, name, ret_type, arg_types, regs, stack_bytes)
@@ -144,6 +309,8 @@ PACK(struct __meta_struct {
 #define META_STRUCT_FIELD_ARRAY(offset, type, name, ...) type name MAP(_ARRAY_DIMENSION, __VA_ARGS__);
 #define END_META_STRUCT(name) } name ;
 #endif
+#define META_STRUCT_SOA(name, ...)
+#define META_FUNCTION_CAPTURE(name)
 
 #endif /** _METADATA_INC */
 
@@ -0,0 +1,806 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * resident watch mode: re-extracts the declarations from the headers text
+ * and regenerates the outputs without going through a metadata rebuild.
+ *
+ * the compiled metadata is used as a seed: it provides the exact sizeof()
+ * of every type in use, as well as addresses/sizes/offsets that are
+ * given as macros (which can't be evaluated from the text).
+ * anything that can't be resolved is reported, and the outputs are left
+ * untouched until metadata is rebuilt.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "metadata.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "watch.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#define IS_END_FIELD(f) ((f)->offset == -1 && (f)->size == -1)
+
+/** sizeof() of type expressions, as stringified by the metadata macros */
+static std::unordered_map<std::string, int> type_sizes;
+/** addresses of functions/data, by name */
+static std::unordered_map<std::string, unsigned long> seed_addrs;
+/** field offsets, by "struct::field" */
+static std::unordered_map<std::string, int> seed_offsets;
+
+static double now_ms(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief collapses whitespace runs like the preprocessor does when stringifying
+ */
+static std::string normalize(const char *begin, const char *end){
+	std::string out;
+	out.reserve(end - begin);
+	bool space = false;
+	for(const char *p = begin; p < end; p++){
+		if(*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'){
+			space = !out.empty();
+			continue;
+		}
+		if(space) out += ' ';
+		space = false;
+		out += *p;
+	}
+	return out;
+}
+
+static std::string normalize(const std::string &s){
+	return normalize(s.data(), s.data() + s.size());
+}
+
+static void seed(uint8_t *start, uint8_t *end){
+	type_sizes["void *"] = sizeof(void *);
+#define BUILTIN(t) type_sizes[#t] = sizeof(t)
+	BUILTIN(char); BUILTIN(signed char); BUILTIN(unsigned char);
+	BUILTIN(short); BUILTIN(unsigned short);
+	BUILTIN(int); BUILTIN(unsigned int); BUILTIN(unsigned);
+	BUILTIN(long); BUILTIN(unsigned long);
+	BUILTIN(long long); BUILTIN(unsigned long long);
+	BUILTIN(float); BUILTIN(double); BUILTIN(long double);
+	BUILTIN(int8_t); BUILTIN(uint8_t); BUILTIN(int16_t); BUILTIN(uint16_t);
+	BUILTIN(int32_t); BUILTIN(uint32_t); BUILTIN(int64_t); BUILTIN(uint64_t);
+	BUILTIN(size_t); BUILTIN(uintptr_t); BUILTIN(intptr_t);
+#undef BUILTIN
+
+	for(uint8_t *p = start; p < end;){
+		enum __meta_item_type type = *(enum __meta_item_type *)p;
+		if(type == META_FREF){
+			struct __meta_function_item *ref = (struct __meta_function_item *)p;
+			if(ref->name) seed_addrs[ref->name] = ref->orig_addr;
+			p += sizeof(*ref);
+		} else if(type == META_DREF){
+			struct __meta_data_item *ref = (struct __meta_data_item *)p;
+			if(ref->name) seed_addrs[ref->name] = ref->orig_addr;
+			p += sizeof(*ref);
+		} else if(type == META_STRUCT){
+			struct __meta_struct *st = (struct __meta_struct *)p;
+			type_sizes[st->name] = st->size;
+			struct __meta_struct_field *f;
+			for(f = st->fields; !IS_END_FIELD(f); f++){
+				if(f->type && f->size > 0) type_sizes[normalize(f->type, f->type + strlen(f->type))] = f->size;
+				if(f->name) seed_offsets[std::string(st->name) + "::" + f->name] = f->offset;
+			}
+			p = (uint8_t *)(f + 1);
+		} else if(type == META_SOA){
+			p += sizeof(struct __meta_soa);
+		} else if(type == META_CAPTURE){
+			p += sizeof(struct __meta_capture);
+		} else {
+			break;
+		}
+	}
+}
+
+static bool parse_number(const std::string &s, long long *out){
+	if(s.empty()) return false;
+	char *end = NULL;
+	*out = strtoll(s.c_str(), &end, 0);
+	while(*end == 'u' || *end == 'U' || *end == 'l' || *end == 'L') end++;
+	return end != s.c_str() && *end == '\0';
+}
+
+static bool type_size(const std::string &type, int *out){
+	auto it = type_sizes.find(type);
+	if(it != type_sizes.end()){
+		*out = it->second;
+		return true;
+	}
+	if(type.find('*') != std::string::npos){
+		*out = sizeof(void *);
+		return true;
+	}
+	static const char *qualifiers[] = { "const ", "volatile ", "struct ", "union " };
+	for(const char *q : qualifiers){
+		size_t len = strlen(q);
+		if(!type.compare(0, len, q)) return type_size(type.substr(len), out);
+	}
+	if(!type.compare(0, 5, "enum ")){
+		*out = sizeof(int);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * @brief a macro invocation, with its arguments already normalized
+ */
+struct text_decl {
+	std::string macro;
+	std::vector<std::string> args;
+	/** raw text of each argument, for the variadic part */
+	std::vector<std::string> raw_args;
+	int line;
+
+	/** stringification of the arguments from `first` on, i.e. #__VA_ARGS__ */
+	std::string va_args(size_t first) const {
+		std::string raw;
+		for(size_t i = first; i < raw_args.size(); i++){
+			if(i > first) raw += ',';
+			raw += raw_args[i];
+		}
+		return normalize(raw);
+	}
+};
+
+struct text_entry {
+	/** either a declaration, or an #include */
+	text_decl decl;
+	std::string include;
+};
+
+struct text_file {
+	std::string path;
+	std::string content;
+	std::vector<text_entry> entries;
+};
+
+static const char *decl_macros[] = {
+	"DECLARE_TARGET_FUNCTION",
+	"DECLARE_FASTCALL_FUNCTION",
+	"DECLARE_STDCALL_FUNCTION",
+	"DECLARE_TARGET_FUNCTION_THUNK",
+	"DECLARE_TARGET_DATA",
+	"DECLARE_TARGET_DATA_DECL",
+	"DECLARE_TARGET_DATA_ARRAY",
+	"BEGIN_META_STRUCT",
+	"META_STRUCT_FIELD",
+	"META_STRUCT_FIELD_ARRAY",
+	"META_STRUCT_FIELD_DECL",
+	"END_META_STRUCT",
+	"META_STRUCT_SOA",
+	"META_FUNCTION_CAPTURE"
+};
+
+static bool is_ident(char c){
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static std::string dirname_of(const std::string &path){
+	size_t slash = path.rfind('/');
+	return (slash == std::string::npos) ? "." : path.substr(0, slash);
+}
+
+static std::string resolve_path(const std::string &path){
+	char *real = realpath(path.c_str(), NULL);
+	if(!real) return std::string();
+	std::string out(real);
+	free(real);
+	return out;
+}
+
+static bool read_file(const std::string &path, std::string *out){
+	FILE *fh = fopen(path.c_str(), "rb");
+	if(!fh) return false;
+	fseek(fh, 0, SEEK_END);
+	long length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+	out->assign(length, '\0');
+	bool ok = length == 0 || fread(&(*out)[0], length, 1, fh) == 1;
+	fclose(fh);
+	return ok;
+}
+
+/**
+ * @brief
+ * extracts the declaration macros and the quoted #includes.
+ * comments are skipped, preprocessor conditionals are not evaluated
+ */
+static void parse_file(text_file *tf){
+	tf->entries.clear();
+
+	// strip comments and line continuations, keeping the line structure
+	std::string src;
+	const std::string &in = tf->content;
+	src.reserve(in.size());
+	for(size_t i = 0; i < in.size(); i++){
+		if(in[i] == '"' || in[i] == '\''){
+			char quote = in[i];
+			src += in[i++];
+			while(i < in.size() && in[i] != quote && in[i] != '\n'){
+				if(in[i] == '\\' && i + 1 < in.size()) src += in[i++];
+				src += in[i++];
+			}
+			if(i < in.size()) src += in[i];
+		} else if(in[i] == '/' && i + 1 < in.size() && in[i + 1] == '/'){
+			while(i < in.size() && in[i] != '\n') i++;
+			if(i < in.size()) src += '\n';
+		} else if(in[i] == '/' && i + 1 < in.size() && in[i + 1] == '*'){
+			src += ' ';
+			for(i += 2; i + 1 < in.size() && !(in[i] == '*' && in[i + 1] == '/'); i++){
+				if(in[i] == '\n') src += '\n';
+			}
+			i++;
+		} else if(in[i] == '\\' && i + 1 < in.size() && in[i + 1] == '\n'){
+			// joined into a single line
+			src += ' ';
+		} else {
+			src += in[i];
+		}
+	}
+
+	int line = 1;
+	bool line_start = true;
+	for(size_t i = 0; i < src.size(); i++){
+		char c = src[i];
+		if(c == '\n'){
+			line++;
+			line_start = true;
+			continue;
+		}
+		if(c == ' ' || c == '\t' || c == '\r') continue;
+
+		if(c == '#' && line_start){
+			size_t eol = src.find('\n', i);
+			if(eol == std::string::npos) eol = src.size();
+			std::string directive = normalize(&src[i + 1], &src[eol]);
+			if(!directive.compare(0, 8, "include ")){
+				size_t q1 = directive.find('"');
+				size_t q2 = directive.rfind('"');
+				if(q1 != std::string::npos && q2 > q1){
+					text_entry entry;
+					entry.include = directive.substr(q1 + 1, q2 - q1 - 1);
+					tf->entries.push_back(entry);
+				}
+			}
+			i = eol - 1;
+			continue;
+		}
+		line_start = false;
+
+		if(c == '"' || c == '\''){
+			for(i++; i < src.size() && src[i] != c; i++){
+				if(src[i] == '\\') i++;
+			}
+			continue;
+		}
+		if(!is_ident(c)) continue;
+
+		size_t begin = i;
+		while(i < src.size() && is_ident(src[i])) i++;
+		std::string ident = src.substr(begin, i - begin);
+		i--;
+
+		bool known = false;
+		for(const char *m : decl_macros){
+			if(ident == m) known = true;
+		}
+		if(!known) continue;
+
+		size_t p = i + 1;
+		while(p < src.size() && (src[p] == ' ' || src[p] == '\t')) p++;
+		if(p >= src.size() || src[p] != '(') continue;
+
+		text_entry entry;
+		entry.decl.macro = ident;
+		entry.decl.line = line;
+		int depth = 0;
+		size_t arg_begin = p + 1;
+		for(p++; p < src.size(); p++){
+			char ch = src[p];
+			if(ch == '\n') line++;
+			if(ch == '"' || ch == '\''){
+				for(p++; p < src.size() && src[p] != ch; p++){
+					if(src[p] == '\\') p++;
+				}
+				continue;
+			}
+			if(ch == '(' || ch == '[' || ch == '{') depth++;
+			else if((ch == ')' || ch == ']' || ch == '}') && depth > 0) depth--;
+			else if((ch == ',' && depth == 0) || ch == ')'){
+				std::string raw = src.substr(arg_begin, p - arg_begin);
+				std::string arg = normalize(raw);
+				// "f()" has no arguments, "f(, x)" has an empty one
+				if(!(ch == ')' && entry.decl.args.empty() && arg.empty())){
+					entry.decl.raw_args.push_back(raw);
+					entry.decl.args.push_back(arg);
+				}
+				arg_begin = p + 1;
+				if(ch == ')') break;
+			}
+		}
+		i = p;
+		tf->entries.push_back(entry);
+	}
+}
+
+/**
+ * @brief
+ * a function/data record, or a whole struct (BEGIN..END) record,
+ * kept across regenerations as long as its text and dependencies don't change
+ */
+struct cached_item {
+	/** owns the strings referenced by `record` */
+	std::deque<std::string> strings;
+	std::vector<uint8_t> record;
+	/** type sizes this record was built with */
+	std::vector<std::pair<std::string, int>> deps;
+	/** size this record declares (for structs) */
+	std::string declares;
+	int declared_size = 0;
+	unsigned generation = 0;
+
+	const char *str(const std::string &s){
+		strings.push_back(s);
+		return strings.back().c_str();
+	}
+
+	bool deps_valid() const {
+		for(const auto &dep : deps){
+			auto it = type_sizes.find(dep.first);
+			if(it == type_sizes.end() || it->second != dep.second) return false;
+		}
+		return true;
+	}
+};
+
+struct watch_state {
+	std::vector<std::string> inputs;
+	std::unordered_map<std::string, std::unique_ptr<text_file>> files;
+	/** included files that couldn't be read, watched in case they're created */
+	std::unordered_set<std::string> missing;
+	/** structs declared by the current generation */
+	std::unordered_set<std::string> declared;
+	std::unordered_map<std::string, std::unique_ptr<cached_item>> cache;
+	std::vector<uint8_t> buffer;
+	unsigned generation = 0;
+	unsigned num_extracted = 0;
+	unsigned num_items = 0;
+};
+
+static watch_state ws;
+
+static bool unresolved(const text_file *tf, const text_decl &d, const char *what, const std::string &value){
+	fprintf(stderr, "%s:%d: can't resolve %s '%s' in %s, rebuild metadata\n",
+		tf->path.c_str(), d.line, what, value.c_str(), d.macro.c_str());
+	return false;
+}
+
+static std::string decl_key(const text_decl &d){
+	std::string key = d.macro;
+	for(const std::string &raw : d.raw_args){
+		key += '\x1f';
+		key += normalize(raw);
+	}
+	return key;
+}
+
+static std::string strip_quotes(const std::string &s){
+	if(s.size() >= 2 && s.front() == '"' && s.back() == '"') return s.substr(1, s.size() - 2);
+	return s;
+}
+
+static bool build_ref(const text_file *tf, const text_decl &d, cached_item *item){
+	const std::string &m = d.macro;
+	bool is_func = m.find("FUNCTION") != std::string::npos;
+	size_t min_args = (m == "DECLARE_STDCALL_FUNCTION" || m == "DECLARE_TARGET_FUNCTION_THUNK") ? 4 : 3;
+	if(d.args.size() < min_args){
+		return unresolved(tf, d, "arguments", m);
+	}
+
+	long long addr;
+	const std::string &name = d.args[2];
+	if(!parse_number(d.args[0], &addr)){
+		auto it = seed_addrs.find(name);
+		if(it == seed_addrs.end()) return unresolved(tf, d, "address", d.args[0]);
+		addr = it->second;
+	}
+
+	if(is_func){
+		struct __meta_function_item ref;
+		memset(&ref, 0, sizeof(ref));
+		ref.item_type = META_FREF;
+		ref.orig_addr = addr;
+		ref.name = item->str(name);
+		ref.ret_type = item->str(d.args[1]);
+		ref.regs = item->str("");
+		ref.stack_bytes = -1;
+		size_t va_first = 3;
+		if(m == "DECLARE_STDCALL_FUNCTION"){
+			long long stack_bytes;
+			if(!parse_number(d.args[3], &stack_bytes)) return unresolved(tf, d, "stack bytes", d.args[3]);
+			ref.stack_bytes = stack_bytes;
+			va_first = 4;
+		} else if(m == "DECLARE_TARGET_FUNCTION_THUNK"){
+			std::string regs = d.args[3];
+			if(regs.empty() || regs.front() != '"') return unresolved(tf, d, "regs", regs);
+			ref.regs = item->str(strip_quotes(regs));
+			va_first = 4;
+		}
+		ref.arg_types = item->str(d.va_args(va_first));
+		item->record.resize(sizeof(ref));
+		memcpy(item->record.data(), &ref, sizeof(ref));
+		return true;
+	}
+
+	std::string type = d.args[1];
+	if(m == "DECLARE_TARGET_DATA_ARRAY"){
+		type += " " + name;
+		for(size_t i = 3; i < d.args.size(); i++) type += "[" + d.args[i] + "]";
+	}
+	struct __meta_data_item ref;
+	memset(&ref, 0, sizeof(ref));
+	ref.item_type = META_DREF;
+	ref.orig_addr = addr;
+	ref.name = item->str(name);
+	ref.type = item->str(type);
+	item->record.resize(sizeof(ref));
+	memcpy(item->record.data(), &ref, sizeof(ref));
+	return true;
+}
+
+static bool build_struct(const text_file *tf, const std::vector<const text_decl *> &decls, cached_item *item){
+	const text_decl &begin = *decls.front();
+	if(begin.args.size() < 2) return unresolved(tf, begin, "arguments", begin.macro);
+	const std::string &st_name = begin.args[0];
+
+	long long st_size;
+	if(!parse_number(begin.args[1], &st_size)){
+		auto it = type_sizes.find(st_name);
+		if(it == type_sizes.end()) return unresolved(tf, begin, "size", begin.args[1]);
+		st_size = it->second;
+	}
+
+	std::vector<struct __meta_struct_field> fields;
+	for(size_t i = 1; i + 1 < decls.size(); i++){
+		const text_decl &d = *decls[i];
+		bool is_decl = d.macro == "META_STRUCT_FIELD_DECL";
+		size_t name_arg = (is_decl) ? 3 : 2;
+		if(d.args.size() <= name_arg) return unresolved(tf, d, "arguments", d.macro);
+
+		const std::string &name = d.args[name_arg];
+		struct __meta_struct_field f;
+		memset(&f, 0, sizeof(f));
+		f.name = item->str(name);
+
+		long long offset;
+		if(!parse_number(d.args[0], &offset)){
+			auto it = seed_offsets.find(st_name + "::" + name);
+			if(it == seed_offsets.end()) return unresolved(tf, d, "offset", d.args[0]);
+			offset = it->second;
+		}
+		f.offset = offset;
+
+		// the expression passed to sizeof()
+		std::string size_expr;
+		if(d.macro == "META_STRUCT_FIELD_ARRAY"){
+			std::string dims;
+			for(size_t j = 3; j < d.args.size(); j++) dims += "[" + d.args[j] + "]";
+			size_expr = d.args[1] + dims;
+			f.type = item->str(size_expr);
+			f.decl = item->str(d.args[1] + " " + name + dims);
+		} else if(is_decl){
+			size_expr = d.args[2];
+			f.type = item->str(size_expr);
+			f.decl = item->str(d.args[1]);
+		} else {
+			size_expr = d.args[1];
+			f.type = item->str(size_expr);
+		}
+
+		int size;
+		if(!type_size(size_expr, &size)){
+			// arrays: element size times the dimensions
+			size_t dim = size_expr.find('[');
+			long long count = 1;
+			bool ok = dim != std::string::npos && type_size(normalize(size_expr.substr(0, dim)), &size);
+			for(size_t j = 3; ok && j < d.args.size(); j++){
+				long long n;
+				ok = parse_number(d.args[j], &n);
+				count *= n;
+			}
+			if(!ok) return unresolved(tf, d, "type", size_expr);
+			item->deps.emplace_back(normalize(size_expr.substr(0, dim)), size);
+			size *= count;
+		} else {
+			item->deps.emplace_back(size_expr, size);
+		}
+		f.size = size;
+		fields.push_back(f);
+	}
+
+	struct __meta_struct_field end_field = { 0, 0, 0, -1, -1 };
+	fields.push_back(end_field);
+
+	item->record.resize(sizeof(struct __meta_struct) + fields.size() * sizeof(struct __meta_struct_field));
+	struct __meta_struct *st = (struct __meta_struct *)item->record.data();
+	st->item_type = META_STRUCT;
+	st->name = item->str(st_name);
+	st->size = st_size;
+	memcpy(st->fields, fields.data(), fields.size() * sizeof(struct __meta_struct_field));
+
+	item->declares = st_name;
+	item->declared_size = st_size;
+	return true;
+}
+
+static bool build_soa(const text_file *tf, const text_decl &d, cached_item *item){
+	if(d.args.size() < 2) return unresolved(tf, d, "arguments", d.macro);
+	struct __meta_soa soa;
+	memset(&soa, 0, sizeof(soa));
+	soa.item_type = META_SOA;
+	soa.name = item->str(d.args[0]);
+	soa.fields = item->str(d.va_args(1));
+	item->record.resize(sizeof(soa));
+	memcpy(item->record.data(), &soa, sizeof(soa));
+	return true;
+}
+
+static bool build_capture(const text_file *tf, const text_decl &d, cached_item *item){
+	if(d.args.size() != 1) return unresolved(tf, d, "arguments", d.macro);
+	struct __meta_capture cap;
+	memset(&cap, 0, sizeof(cap));
+	cap.item_type = META_CAPTURE;
+	cap.name = item->str(d.args[0]);
+	item->record.resize(sizeof(cap));
+	memcpy(item->record.data(), &cap, sizeof(cap));
+	return true;
+}
+
+static text_file *load_file(const std::string &path){
+	auto it = ws.files.find(path);
+	if(it != ws.files.end()) return it->second.get();
+
+	std::unique_ptr<text_file> tf(new text_file);
+	tf->path = path;
+	if(!read_file(path, &tf->content)){
+		ws.missing.insert(path);
+		return NULL;
+	}
+	parse_file(tf.get());
+	text_file *ret = tf.get();
+	ws.files[path] = std::move(tf);
+	return ret;
+}
+
+/**
+ * @brief appends the records of `path` (and its includes) to the buffer
+ */
+static bool collect(const std::string &path, std::unordered_set<std::string> &visited){
+	if(!visited.insert(path).second) return true;
+	text_file *tf = load_file(path);
+	if(!tf) return true;
+
+	std::vector<const text_decl *> st_decls;
+	for(const text_entry &e : tf->entries){
+		if(!e.include.empty()){
+			std::string candidate = dirname_of(path) + "/" + e.include;
+			std::string inc = resolve_path(candidate);
+			if(inc.empty()){
+				// not there (yet): watched in case it's created, if its directory exists.
+				// includes outside of the watched tree (e.g. metadata.h) end up here too
+				std::string dir = resolve_path(dirname_of(candidate));
+				if(!dir.empty()) ws.missing.insert(dir + candidate.substr(candidate.find_last_of('/')));
+				continue;
+			}
+			if(!collect(inc, visited)) return false;
+			continue;
+		}
+
+		const text_decl &d = e.decl;
+		bool in_struct = !st_decls.empty();
+		if(d.macro == "BEGIN_META_STRUCT" || in_struct){
+			st_decls.push_back(&d);
+			if(d.macro != "END_META_STRUCT") continue;
+		}
+
+		std::string key;
+		if(!st_decls.empty()){
+			for(const text_decl *sd : st_decls) key += decl_key(*sd) + '\x1e';
+		} else if(d.macro.compare(0, 8, "DECLARE_") == 0
+			|| d.macro == "META_STRUCT_SOA"
+			|| d.macro == "META_FUNCTION_CAPTURE"
+		){
+			key = decl_key(d);
+		} else {
+			fprintf(stderr, "%s:%d: %s outside of a struct\n", path.c_str(), d.line, d.macro.c_str());
+			continue;
+		}
+
+		std::unique_ptr<cached_item> &item = ws.cache[key];
+		if(!item || !item->deps_valid()){
+			item.reset(new cached_item);
+			bool ok = (!st_decls.empty())
+				? build_struct(tf, st_decls, item.get())
+				: (d.macro == "META_STRUCT_SOA")
+				? build_soa(tf, d, item.get())
+				: (d.macro == "META_FUNCTION_CAPTURE")
+				? build_capture(tf, d, item.get())
+				: build_ref(tf, d, item.get());
+			if(!ok){
+				ws.cache.erase(key);
+				return false;
+			}
+			++ws.num_extracted;
+		}
+		item->generation = ws.generation;
+		if(!item->declares.empty()){
+			type_sizes[item->declares] = item->declared_size;
+			ws.declared.insert(item->declares);
+		}
+		ws.buffer.insert(ws.buffer.end(), item->record.begin(), item->record.end());
+		++ws.num_items;
+		st_decls.clear();
+	}
+	return true;
+}
+
+static int rebuild(){
+	double t_start = now_ms();
+	ws.num_extracted = 0;
+
+	// a struct that went away invalidates its dependents, which must then be collected again
+	for(bool removed = true; removed;){
+		++ws.generation;
+		ws.num_items = 0;
+		ws.buffer.clear();
+		ws.missing.clear();
+		ws.declared.clear();
+
+		std::unordered_set<std::string> visited;
+		for(const std::string &input : ws.inputs){
+			if(!collect(input, visited)) return -1;
+		}
+
+		// drop the declarations that went away, and the sizes of the structs they declared
+		removed = false;
+		for(auto it = ws.cache.begin(); it != ws.cache.end();){
+			if(it->second->generation == ws.generation){
+				++it;
+				continue;
+			}
+			const std::string &declares = it->second->declares;
+			if(!declares.empty() && !ws.declared.count(declares)){
+				removed |= type_sizes.erase(declares) > 0;
+			}
+			it = ws.cache.erase(it);
+		}
+	}
+
+	int ret = regenerate(ws.buffer.data(), ws.buffer.data() + ws.buffer.size());
+	fprintf(stderr, "watch: %u/%u declarations re-extracted, regenerated in %.3f ms\n",
+		ws.num_extracted, ws.num_items, now_ms() - t_start);
+	return ret;
+}
+
+#ifdef __linux__
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+int watch_main(int num_inputs, const char **inputs, uint8_t *seed_start, uint8_t *seed_end){
+	seed(seed_start, seed_end);
+
+	for(int i = 0; i < num_inputs; i++){
+		std::string path = resolve_path(inputs[i]);
+		if(path.empty()){
+			fprintf(stderr, "Failed to open file '%s' for reading\n", inputs[i]);
+			return 1;
+		}
+		ws.inputs.push_back(path);
+	}
+
+	int fd = inotify_init1(IN_CLOEXEC);
+	if(fd < 0){
+		perror("inotify_init1");
+		return 1;
+	}
+	// watch the directories, since editors often replace files by renaming
+	std::unordered_map<int, std::string> watch_dirs;
+	std::unordered_set<std::string> watched;
+	auto watch_dir = [&](const std::string &path){
+		std::string dir = dirname_of(path);
+		if(watched.count(dir)) return;
+		int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE);
+		if(wd < 0) return;
+		watched.insert(dir);
+		watch_dirs[wd] = dir;
+	};
+	auto update_watches = [&](){
+		for(const auto &f : ws.files) watch_dir(f.first);
+		for(const std::string &path : ws.missing) watch_dir(path);
+	};
+
+	rebuild();
+	update_watches();
+
+	alignas(struct inotify_event) char events[16 * 1024];
+	for(;;){
+		std::unordered_set<std::string> changed;
+		int timeout = -1;
+		for(;;){
+			// after the first event, wait a little for the rest of the burst
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			if(poll(&pfd, 1, timeout) <= 0) break;
+			ssize_t length = read(fd, events, sizeof(events));
+			if(length <= 0) break;
+			for(char *p = events; p < events + length;){
+				struct inotify_event *ev = (struct inotify_event *)p;
+				p += sizeof(*ev) + ev->len;
+				if(ev->len == 0) continue;
+				std::string path = watch_dirs[ev->wd] + "/" + ev->name;
+				if(ws.files.count(path) || ws.missing.count(path)) changed.insert(path);
+			}
+			timeout = 5;
+		}
+
+		bool dirty = false;
+		for(const std::string &path : changed){
+			std::string content;
+			auto it = ws.files.find(path);
+			bool exists = read_file(path, &content);
+			if(it == ws.files.end()){
+				// a missing include was created
+				dirty |= exists;
+				continue;
+			}
+			if(exists && content == it->second->content) continue;
+			// re-parsed (and re-watched) on the next rebuild
+			ws.files.erase(it);
+			dirty = true;
+		}
+		if(!dirty) continue;
+
+		rebuild();
+		update_watches();
+	}
+	return 0;
+}
+
+#else
+
+int watch_main(int num_inputs, const char **inputs, uint8_t *seed_start, uint8_t *seed_end){
+	fprintf(stderr, "watch mode is only supported on Linux\n");
+	return 1;
+}
+
+#endif
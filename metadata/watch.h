@@ -0,0 +1,19 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief
+ * resident mode: watch the given headers and regenerate the outputs on change.
+ * the compiled metadata in [seed_start, seed_end) provides the type sizes and
+ * any value that can't be evaluated from the headers text
+ */
+int watch_main(int num_inputs, const char **inputs, uint8_t *seed_start, uint8_t *seed_end);
+
+/**
+ * @brief converts the items in [start, end) to the named outputs (implemented in metadata.cpp)
+ */
+int regenerate(uint8_t *start, uint8_t *end);
@@ -0,0 +1,67 @@
+#pragma once
+/**
+ * @brief
+ * helpers shared by the benchmarks of the generated code (-DMIR_BENCH=ON)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/** records per run, sized to exceed the last level cache */
+#ifndef BENCH_COUNT
+#define BENCH_COUNT (1 << 20)
+#endif
+
+#ifndef BENCH_RUNS
+#define BENCH_RUNS 10
+#endif
+
+static inline double bench_now(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** keeps the compiler from optimizing the benchmarked work away */
+static volatile unsigned long bench_sink;
+
+/** runs `body` BENCH_RUNS times, after an untimed warm-up run, and prints the best time per record */
+#define BENCH(label, count, body) do { \
+	double __best = 1e30; \
+	body; \
+	for(int __run = 0; __run < BENCH_RUNS; __run++){ \
+		double __t0 = bench_now(); \
+		body; \
+		double __t = bench_now() - __t0; \
+		if(__t < __best) __best = __t; \
+	} \
+	printf("%-24s %8.3f ms %8.2f ns/record\n", label, __best * 1e3, __best * 1e9 / (count)); \
+} while(0)
+
+/**
+ * @brief
+ * like BENCH, for two equivalent kernels. their runs are interleaved,
+ * so that neither gets a warmer cache or a higher clock just by running second
+ */
+#define BENCH_COMPARE(label_a, body_a, label_b, body_b, count) do { \
+	double __best_a = 1e30, __best_b = 1e30; \
+	body_a; \
+	body_b; \
+	for(int __run = 0; __run < BENCH_RUNS; __run++){ \
+		double __t0 = bench_now(); \
+		body_a; \
+		double __t1 = bench_now(); \
+		body_b; \
+		double __t2 = bench_now(); \
+		if(__t1 - __t0 < __best_a) __best_a = __t1 - __t0; \
+		if(__t2 - __t1 < __best_b) __best_b = __t2 - __t1; \
+	} \
+	printf("%-24s %8.3f ms %8.2f ns/record\n", label_a, __best_a * 1e3, __best_a * 1e9 / (count)); \
+	printf("%-24s %8.3f ms %8.2f ns/record\n", label_b, __best_b * 1e3, __best_b * 1e9 / (count)); \
+} while(0)
+
+static inline void bench_fill(void *p, size_t size){
+	unsigned char *b = (unsigned char *)p;
+	for(size_t i = 0; i < size; i++) b[i] = (unsigned char)rand();
+}
@@ -0,0 +1,78 @@
+/**
+ * @brief
+ * generated padding-aware equality/hash (mask_generated.h)
+ * against hand-written field-by-field comparison and hashing
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+#include "mask_generated.h"
+
+static int fields_equal(const sample_struct *a, const sample_struct *b){
+	return a->foo == b->foo && a->bar == b->bar;
+}
+
+static uint64_t fields_hash(const sample_struct *p){
+	uint64_t h = 0;
+	h = (((h << 5) | (h >> 59)) ^ (uint32_t)p->foo) * 0x517cc1b727220a95ULL;
+	h = (((h << 5) | (h >> 59)) ^ p->bar) * 0x517cc1b727220a95ULL;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+int main(void){
+	size_t count = BENCH_COUNT;
+	sample_struct *a = malloc(count * sizeof(*a));
+	sample_struct *b = malloc(count * sizeof(*b));
+	uint64_t *hashes = malloc(count * sizeof(*hashes));
+	if(!a || !b || !hashes) return 1;
+	// same fields, different padding
+	bench_fill(a, count * sizeof(*a));
+	bench_fill(b, count * sizeof(*b));
+	for(size_t i = 0; i < count; i++){
+		b[i].foo = a[i].foo;
+		b[i].bar = a[i].bar;
+	}
+	printf("%zu records of %zu bytes\n", count, sizeof(*a));
+
+	size_t n_masked = 0, n_fields = 0, n_memcmp = 0, n_hash = 0;
+	for(size_t i = 0; i < count; i++){
+		n_masked += struct_equal_sample_struct(&a[i], &b[i]);
+		n_fields += fields_equal(&a[i], &b[i]);
+		n_memcmp += !memcmp(&a[i], &b[i], sizeof(*a));
+		n_hash += struct_hash_sample_struct(&a[i]) == struct_hash_sample_struct(&b[i]);
+	}
+	printf("equal records: masked %zu, fields %zu, memcmp %zu, equal hashes %zu\n",
+		n_masked, n_fields, n_memcmp, n_hash);
+
+	BENCH_COMPARE("equal (generated)", {
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++) n += struct_equal_sample_struct(&a[i], &b[i]);
+		bench_sink += n;
+	}, "equal (fields)", {
+		size_t n = 0;
+		for(size_t i = 0; i < count; i++) n += fields_equal(&a[i], &b[i]);
+		bench_sink += n;
+	}, count);
+	BENCH_COMPARE("hash (generated)", {
+		uint64_t h = 0;
+		for(size_t i = 0; i < count; i++) h += struct_hash_sample_struct(&a[i]);
+		bench_sink += h;
+	}, "hash (fields)", {
+		uint64_t h = 0;
+		for(size_t i = 0; i < count; i++) h += fields_hash(&a[i]);
+		bench_sink += h;
+	}, count);
+	BENCH("hash_n (generated)", count, struct_hash_n_sample_struct(hashes, a, count));
+	BENCH("find (generated)", count, bench_sink += struct_find_sample_struct(&a[count - 1], b, count));
+
+	int ok = n_masked == count && n_fields == count && n_hash == count;
+	free(a);
+	free(b);
+	free(hashes);
+	return (ok) ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/**
+ * @brief
+ * generated struct-of-arrays gather/scatter (soa_generated.h)
+ * against the naive loop, that copies all the fields of a record at once
+ */
+
+#include <string.h>
+
+#include "bench.h"
+#include "soa_generated.h"
+
+static void naive_gather(int *foo, unsigned char *bar, const sample_struct *aos, size_t count){
+	for(size_t i = 0; i < count; i++){
+		foo[i] = aos[i].foo;
+		bar[i] = aos[i].bar;
+	}
+}
+
+static void naive_scatter(sample_struct *aos, const int *foo, const unsigned char *bar, size_t count){
+	for(size_t i = 0; i < count; i++){
+		aos[i].foo = foo[i];
+		aos[i].bar = bar[i];
+	}
+}
+
+int main(void){
+	size_t count = BENCH_COUNT;
+	sample_struct *aos = malloc(count * sizeof(*aos));
+	sample_struct *check = malloc(count * sizeof(*check));
+	int *foo = malloc(count * sizeof(*foo));
+	unsigned char *bar = malloc(count);
+	if(!aos || !check || !foo || !bar) return 1;
+	bench_fill(aos, count * sizeof(*aos));
+
+	sample_struct_soa soa = { foo, bar };
+	printf("%zu records of %zu bytes\n", count, sizeof(*aos));
+
+	BENCH_COMPARE(
+		"gather (generated)", sample_struct_soa_gather(&soa, aos, count),
+		"gather (naive)", naive_gather(foo, bar, aos, count), count);
+	BENCH_COMPARE(
+		"scatter (generated)", sample_struct_soa_scatter(aos, &soa, count),
+		"scatter (naive)", naive_scatter(aos, foo, bar, count), count);
+
+	// both must produce the same records
+	memcpy(check, aos, count * sizeof(*aos));
+	for(size_t i = 0; i < count; i++){
+		foo[i] = (int)i;
+		bar[i] = (unsigned char)(i * 7);
+	}
+	sample_struct_soa_scatter(aos, &soa, count);
+	naive_scatter(check, foo, bar, count);
+	int ok = !memcmp(aos, check, count * sizeof(*aos));
+	printf("results match: %s\n", (ok) ? "yes" : "NO");
+
+	bench_sink += aos[count - 1].foo;
+	free(aos);
+	free(check);
+	free(foo);
+	free(bar);
+	return (ok) ? 0 : 1;
+}
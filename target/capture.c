@@ -0,0 +1,229 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * argument capture and replay, see capture.h
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define CAPTURE_REPLAY_TABLE
+#include "capture.h"
+
+/** minimum measuring time per function, like Google Benchmark's --benchmark_min_time */
+#define CAPTURE_MIN_TIME 0.1
+
+struct capture_writer {
+	int busy;
+	/** the record couldn't be buffered, it's dropped at capture_end */
+	int failed;
+	uint32_t id;
+	uint8_t *buf;
+	size_t len;
+	size_t cap;
+};
+
+static FILE *corpus = NULL;
+static __thread struct capture_writer writer;
+static unsigned long lost = 0;
+
+int capture_open(const char *path){
+	if(corpus) return -1;
+	corpus = fopen(path, "wb");
+	if(!corpus){
+		fprintf(stderr, "capture: cannot open %s\n", path);
+		return -1;
+	}
+	uint32_t version = CAPTURE_VERSION;
+	fwrite(CAPTURE_MAGIC, 4, 1, corpus);
+	fwrite(&version, sizeof(version), 1, corpus);
+	return 0;
+}
+
+void capture_close(void){
+	if(!corpus) return;
+	fclose(corpus);
+	corpus = NULL;
+	if(capture_lost() > 0){
+		fprintf(stderr, "capture: %lu records lost (out of memory)\n", capture_lost());
+	}
+}
+
+unsigned long capture_lost(void){
+	return __atomic_load_n(&lost, __ATOMIC_RELAXED);
+}
+
+struct capture_writer *capture_begin(uint32_t id){
+	struct capture_writer *w = &writer;
+	if(!corpus || w->busy) return NULL;
+	w->busy = 1;
+	w->failed = 0;
+	w->id = id;
+	w->len = 0;
+	return w;
+}
+
+void capture_write(struct capture_writer *w, const void *data, size_t size){
+	if(w->failed) return;
+	if(w->len + size > w->cap){
+		size_t cap = (w->cap > 0) ? w->cap : 256;
+		while(cap < w->len + size) cap *= 2;
+		uint8_t *buf = realloc(w->buf, cap);
+		if(!buf){
+			w->failed = 1;
+			return;
+		}
+		w->buf = buf;
+		w->cap = cap;
+	}
+	memcpy(w->buf + w->len, data, size);
+	w->len += size;
+}
+
+void capture_write_pointee(struct capture_writer *w, const void *ptr, size_t size){
+	uint8_t present = (ptr != NULL);
+	capture_write(w, &present, sizeof(present));
+	if(present) capture_write(w, ptr, size);
+}
+
+void capture_end(struct capture_writer *w){
+	w->busy = 0;
+	// a truncated record would be replayed with garbage arguments
+	if(w->failed){
+		__atomic_fetch_add(&lost, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	uint32_t header[2] = { w->id, (uint32_t)w->len };
+	// records from different threads must not interleave
+	flockfile(corpus);
+	fwrite(header, sizeof(header), 1, corpus);
+	fwrite(w->buf, w->len, 1, corpus);
+	funlockfile(corpus);
+}
+
+struct capture_record {
+	const struct capture_replay *fn;
+	const uint8_t *data;
+	uint32_t size;
+};
+
+static const struct capture_replay *find_replay(uint32_t id){
+	for(const struct capture_replay *r = capture_replays; r->replay; r++){
+		if(r->id == id) return r;
+	}
+	return NULL;
+}
+
+static double now(void){
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double run_pass(const struct capture_record *records, size_t count, const struct capture_replay *fn, unsigned passes, int call){
+	double start = now();
+	for(unsigned p = 0; p < passes; p++){
+		for(size_t i = 0; i < count; i++){
+			if(records[i].fn != fn) continue;
+			struct capture_reader r = { records[i].data, records[i].data + records[i].size };
+			fn->replay(&r, call);
+		}
+	}
+	return now() - start;
+}
+
+static uint8_t *read_file(const char *path, size_t *size){
+	FILE *fh = fopen(path, "rb");
+	if(!fh) return NULL;
+	fseek(fh, 0, SEEK_END);
+	long length = ftell(fh);
+	fseek(fh, 0, SEEK_SET);
+	uint8_t *data = (length > 0) ? malloc(length) : NULL;
+	if(data && fread(data, length, 1, fh) != 1){
+		free(data);
+		data = NULL;
+	}
+	fclose(fh);
+	*size = (size_t)length;
+	return data;
+}
+
+int capture_replay_corpus(const char *path, FILE *out){
+	size_t size = 0;
+	uint8_t *data = read_file(path, &size);
+	uint32_t version = 0;
+	if(data && size >= 8) memcpy(&version, data + 4, sizeof(version));
+	if(!data || size < 8 || memcmp(data, CAPTURE_MAGIC, 4) || version != CAPTURE_VERSION){
+		fprintf(stderr, "capture: %s is not a v%d corpus\n", path, CAPTURE_VERSION);
+		free(data);
+		return -1;
+	}
+
+	size_t count = 0;
+	for(size_t off = 8; off + 8 <= size; count++){
+		uint32_t header[2];
+		memcpy(header, data + off, sizeof(header));
+		off += 8 + header[1];
+	}
+	struct capture_record *records = calloc(count + 1, sizeof(*records));
+	if(!records){
+		free(data);
+		return -1;
+	}
+
+	count = 0;
+	for(size_t off = 8; off + 8 <= size;){
+		uint32_t header[2];
+		memcpy(header, data + off, sizeof(header));
+		off += 8;
+		if(header[1] > size - off){
+			fprintf(stderr, "capture: %s is truncated\n", path);
+			break;
+		}
+		const struct capture_replay *fn = find_replay(header[0]);
+		if(!fn){
+			fprintf(stderr, "capture: skipping unknown function 0x%08x\n", header[0]);
+		} else {
+			records[count].fn = fn;
+			records[count].data = data + off;
+			records[count].size = header[1];
+			count++;
+		}
+		off += header[1];
+	}
+
+	fprintf(out, "%-40s %14s %14s %10s\n", "Function", "Time (ns)", "Iterations", "Records");
+	for(const struct capture_replay *fn = capture_replays; fn->replay; fn++){
+		unsigned num_records = 0;
+		for(size_t i = 0; i < count; i++){
+			if(records[i].fn == fn) num_records++;
+		}
+		if(num_records == 0) continue;
+
+		// grow the number of passes until the run is long enough to be measured,
+		// then subtract the time spent decoding the arguments
+		unsigned passes = 1;
+		double elapsed = 0, decode = 0;
+		for(;;){
+			elapsed = run_pass(records, count, fn, passes, 1);
+			if(elapsed >= CAPTURE_MIN_TIME || passes >= (1u << 30)) break;
+			double scale = (elapsed > 0) ? (CAPTURE_MIN_TIME * 1.4 / elapsed) : 10;
+			if(scale > 10) scale = 10;
+			if(scale < 2) scale = 2;
+			passes = (unsigned)(passes * scale);
+		}
+		decode = run_pass(records, count, fn, passes, 0);
+
+		double iterations = (double)passes * num_records;
+		double ns = (elapsed > decode) ? (elapsed - decode) * 1e9 / iterations : 0;
+		fprintf(out, "%-40s %14.2f %14.0f %10u\n", fn->name, ns, iterations, num_records);
+	}
+
+	free(records);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+/**
+ * @brief
+ * argument capture and replay for reimplemented functions (META_FUNCTION_CAPTURE)
+ *
+ * while a corpus is open, CAPTURE_CALL() records the arguments of each call,
+ * including the contents of pointed-to metadata structs.
+ * the corpus can then be replayed against the reimplementation, as a benchmark
+ * or to compare it with the original.
+ *
+ * corpus format: "MIRC", u32 version, then one record per call:
+ * u32 function id (CAPTURE_ID_<name>), u32 payload size, payload
+ *
+ * build with -DMIR_CAPTURE=ON, otherwise CAPTURE_CALL() compiles to nothing
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define CAPTURE_MAGIC "MIRC"
+#define CAPTURE_VERSION 1
+
+#ifdef MIR_CAPTURE
+
+struct capture_writer;
+
+struct capture_reader {
+	const uint8_t *p;
+	const uint8_t *end;
+};
+
+struct capture_replay {
+	uint32_t id;
+	const char *name;
+	/** decodes one record, and calls the function if `call` is set */
+	void (*replay)(struct capture_reader *r, int call);
+};
+
+/**
+ * @brief start appending calls to the corpus at `path`
+ */
+int capture_open(const char *path);
+void capture_close(void);
+
+/**
+ * @brief start a record for function `id`
+ * @return NULL if no corpus is open, or if called while already capturing
+ * (calls made by a captured function are not recorded)
+ */
+struct capture_writer *capture_begin(uint32_t id);
+void capture_write(struct capture_writer *w, const void *data, size_t size);
+/** writes a presence flag, followed by the `size` bytes at `ptr` when it's not NULL */
+void capture_write_pointee(struct capture_writer *w, const void *ptr, size_t size);
+/** writes the record, or drops it if it couldn't be buffered */
+void capture_end(struct capture_writer *w);
+/** @return the number of records dropped because they couldn't be buffered */
+unsigned long capture_lost(void);
+
+/** reads past the end of a record are zero-filled */
+static inline void capture_read(struct capture_reader *r, void *data, size_t size){
+	uint8_t *d = (uint8_t *)data;
+	for(size_t i = 0; i < size; i++){
+		d[i] = (r->p < r->end) ? *r->p++ : 0;
+	}
+}
+
+static inline int capture_read_pointee(struct capture_reader *r, void *data, size_t size){
+	uint8_t present = 0;
+	capture_read(r, &present, sizeof(present));
+	if(!present) return 0;
+	capture_read(r, data, size);
+	return 1;
+}
+
+/**
+ * @brief replays every call in the corpus at `path`, and writes the time per call to `out`
+ * @return 0 on success, -1 if the corpus can't be read
+ */
+int capture_replay_corpus(const char *path, FILE *out);
+
+#include "capture_generated.h"
+
+#define CAPTURE_CALL(name, ...) __capture_ ## name(__VA_ARGS__)
+
+#else
+
+#define CAPTURE_CALL(name, ...) ((void)0)
+
+#endif
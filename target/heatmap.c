@@ -0,0 +1,321 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * field access heatmap, see heatmap.h
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heatmap.h"
+#include "layout.h"
+#include "layout_generated.h"
+
+#if defined(__linux__) && (defined(__i386__) || defined(__x86_64__))
+
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+/**
+ * REG_EFL is only visible with _GNU_SOURCE,
+ * which can't be enabled after common.h has been force-included
+ */
+#ifdef REG_EFL
+#define HEATMAP_REG_EFL REG_EFL
+#elif defined(__x86_64__)
+#define HEATMAP_REG_EFL 17
+#else
+#define HEATMAP_REG_EFL 16
+#endif
+
+#define EFLAGS_TF 0x100
+
+#define HEATMAP_MAX_WATCHES 64
+
+struct heatmap_watch {
+	const char *name;
+	const struct meta_layout *layout;
+	uintptr_t base;
+	size_t size;
+	uintptr_t page_begin;
+	uintptr_t page_end;
+	unsigned long samples;
+	/** one counter per field, plus one for padding/unknown bytes */
+	unsigned long *hits;
+};
+
+/**
+ * all the profiler state lives in its own mapping,
+ * so that it can't share a page with a watched object
+ * (which would make the fault handler fault on itself)
+ */
+struct heatmap_state {
+	uintptr_t page_size;
+	volatile sig_atomic_t running;
+	volatile sig_atomic_t budget;
+	unsigned max_budget;
+	int num_watches;
+	struct sigaction old_segv, old_trap, old_prof;
+	struct heatmap_watch watches[HEATMAP_MAX_WATCHES];
+};
+
+static struct heatmap_state *hm = NULL;
+
+/** page being single-stepped by the current thread, if any */
+static __thread uintptr_t pending_page = 0;
+
+static void *heatmap_alloc(size_t size){
+	void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+static const struct meta_layout *find_layout(const char *type){
+	for(const struct meta_layout *l = meta_layouts; l->name; l++){
+		if(!strcmp(l->name, type)) return l;
+	}
+	return NULL;
+}
+
+static int overlaps(uintptr_t begin, uintptr_t end, const void *ptr, size_t size){
+	uintptr_t p = (uintptr_t)ptr;
+	return p < end && p + size > begin;
+}
+
+int heatmap_watch(const char *name, void *addr, size_t size, const char *type){
+	const struct meta_layout *layout = find_layout(type);
+	if(!layout){
+		fprintf(stderr, "heatmap: unknown type %s for %s\n", type, name);
+		return -1;
+	}
+	if(!hm){
+		hm = heatmap_alloc(sizeof(*hm));
+		if(!hm) return -1;
+		hm->page_size = sysconf(_SC_PAGESIZE);
+	}
+	if(hm->num_watches >= HEATMAP_MAX_WATCHES){
+		fprintf(stderr, "heatmap: too many objects, can't watch %s\n", name);
+		return -1;
+	}
+
+	struct heatmap_watch *w = &hm->watches[hm->num_watches];
+	w->name = name;
+	w->layout = layout;
+	w->base = (uintptr_t)addr;
+	w->size = size;
+	w->page_begin = w->base & ~(hm->page_size - 1);
+	w->page_end = (w->base + size + hm->page_size - 1) & ~(hm->page_size - 1);
+	w->samples = 0;
+
+	if(overlaps(w->page_begin, w->page_end, &hm, sizeof(hm))
+	|| overlaps(w->page_begin, w->page_end, &pending_page, sizeof(pending_page))
+	){
+		fprintf(stderr, "heatmap: %s shares a page with the profiler, can't watch it\n", name);
+		return -1;
+	}
+
+	w->hits = heatmap_alloc((layout->num_fields + 1) * sizeof(*w->hits));
+	if(!w->hits) return -1;
+	++hm->num_watches;
+	return 0;
+}
+
+static void protect_all(int prot){
+	uintptr_t page_size = hm->page_size;
+	for(int i=0; i<hm->num_watches; i++){
+		struct heatmap_watch *w = &hm->watches[i];
+		uintptr_t skip = pending_page;
+		if(skip >= w->page_begin && skip < w->page_end){
+			// re-protecting it now would fault again on the instruction being stepped
+			if(skip > w->page_begin){
+				mprotect((void *)w->page_begin, skip - w->page_begin, prot);
+			}
+			if(skip + page_size < w->page_end){
+				mprotect((void *)(skip + page_size), w->page_end - (skip + page_size), prot);
+			}
+		} else {
+			mprotect((void *)w->page_begin, w->page_end - w->page_begin, prot);
+		}
+	}
+}
+
+static void account(uintptr_t addr){
+	struct heatmap_watch *w = NULL;
+	for(int i=0; i<hm->num_watches; i++){
+		if(addr >= hm->watches[i].base && addr < hm->watches[i].base + hm->watches[i].size){
+			w = &hm->watches[i];
+			break;
+		}
+	}
+	// another object sharing the page
+	if(!w) return;
+
+	const struct meta_layout *l = w->layout;
+	size_t offset = addr - w->base;
+	if(l->size > 0) offset %= l->size;
+
+	int lo = 0, hi = l->num_fields - 1, hit = l->num_fields;
+	while(lo <= hi){
+		int mid = (lo + hi) / 2;
+		const struct meta_layout_field *f = &l->fields[mid];
+		if(offset < (size_t)f->offset){
+			hi = mid - 1;
+		} else if(offset >= (size_t)(f->offset + ((f->size > 0) ? f->size : 1))){
+			lo = mid + 1;
+		} else {
+			hit = mid;
+			break;
+		}
+	}
+	++w->hits[hit];
+	++w->samples;
+}
+
+static int is_watched_page(uintptr_t page){
+	for(int i=0; i<hm->num_watches; i++){
+		if(page >= hm->watches[i].page_begin && page < hm->watches[i].page_end) return 1;
+	}
+	return 0;
+}
+
+static void on_segv(int sig, siginfo_t *si, void *ctx){
+	(void)sig;
+	uintptr_t addr = (uintptr_t)si->si_addr;
+	uintptr_t page = addr & ~(hm->page_size - 1);
+	if(!is_watched_page(page)){
+		// a genuine fault, let it crash on return
+		sigaction(SIGSEGV, &hm->old_segv, NULL);
+		return;
+	}
+
+	if(page != pending_page){
+		account(addr);
+		--hm->budget;
+	}
+	mprotect((void *)page, hm->page_size, PROT_READ | PROT_WRITE);
+	pending_page = page;
+
+	// execute the faulting instruction, then trap back into on_trap
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uc->uc_mcontext.gregs[HEATMAP_REG_EFL] |= EFLAGS_TF;
+}
+
+static void on_trap(int sig, siginfo_t *si, void *ctx){
+	(void)sig;
+	(void)si;
+	if(!pending_page){
+		sigaction(SIGTRAP, &hm->old_trap, NULL);
+		return;
+	}
+	ucontext_t *uc = (ucontext_t *)ctx;
+	uc->uc_mcontext.gregs[HEATMAP_REG_EFL] &= ~EFLAGS_TF;
+
+	// over budget: leave the page open until the next tick
+	if(hm->running && hm->budget > 0){
+		mprotect((void *)pending_page, hm->page_size, PROT_NONE);
+	}
+	pending_page = 0;
+}
+
+static void on_tick(int sig){
+	(void)sig;
+	if(!hm->running) return;
+	hm->budget = hm->max_budget;
+	protect_all(PROT_NONE);
+}
+
+int heatmap_start(unsigned max_samples, unsigned tick_us){
+	if(!hm || hm->num_watches == 0 || hm->running) return -1;
+	// without a timer the budget would never be refilled
+	if(tick_us == 0) return -1;
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sigemptyset(&sa.sa_mask);
+	sigaddset(&sa.sa_mask, SIGPROF);
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+
+	sa.sa_sigaction = on_segv;
+	sigaction(SIGSEGV, &sa, &hm->old_segv);
+	sa.sa_sigaction = on_trap;
+	sigaction(SIGTRAP, &sa, &hm->old_trap);
+
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = on_tick;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGPROF, &sa, &hm->old_prof);
+
+	hm->max_budget = max_samples;
+	hm->budget = max_samples;
+	hm->running = 1;
+	protect_all(PROT_NONE);
+
+	struct itimerval timer;
+	timer.it_interval.tv_sec = tick_us / 1000000;
+	timer.it_interval.tv_usec = tick_us % 1000000;
+	timer.it_value = timer.it_interval;
+	return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void heatmap_stop(void){
+	if(!hm || !hm->running) return;
+
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+
+	hm->running = 0;
+	protect_all(PROT_READ | PROT_WRITE);
+	sigaction(SIGPROF, &hm->old_prof, NULL);
+	sigaction(SIGTRAP, &hm->old_trap, NULL);
+	sigaction(SIGSEGV, &hm->old_segv, NULL);
+}
+
+void heatmap_dump(FILE *fh){
+	fprintf(fh, "[");
+	for(int i=0; hm && i<hm->num_watches; i++){
+		struct heatmap_watch *w = &hm->watches[i];
+		fprintf(fh, "%s\n{\n"
+			"  \"name\": \"%s\",\n"
+			"  \"type\": \"%s\",\n"
+			"  \"samples\": %lu,\n"
+			"  \"fields\": {",
+			(i > 0) ? "," : "",
+			w->name, w->layout->name, w->samples);
+		for(int j=0; j<w->layout->num_fields; j++){
+			fprintf(fh, "\n    \"%s\": %lu,", w->layout->fields[j].name, w->hits[j]);
+		}
+		fprintf(fh, "\n    \"__padding\": %lu\n  }\n}", w->hits[w->layout->num_fields]);
+	}
+	fprintf(fh, "]\n");
+}
+
+#else
+
+int heatmap_watch(const char *name, void *addr, size_t size, const char *type){
+	(void)name;
+	(void)addr;
+	(void)size;
+	(void)type;
+	fprintf(stderr, "heatmap: not supported on this platform\n");
+	return -1;
+}
+
+int heatmap_start(unsigned max_samples, unsigned tick_us){
+	(void)max_samples;
+	(void)tick_us;
+	return -1;
+}
+
+void heatmap_stop(void){}
+
+void heatmap_dump(FILE *fh){
+	fprintf(fh, "[]\n");
+}
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+/**
+ * @brief
+ * field access heatmap for original data (Linux/x86 only)
+ *
+ * the pages holding the watched objects are write/read protected.
+ * each access faults, gets mapped to a struct field through the generated
+ * layout tables, and is then single-stepped with the page unprotected.
+ *
+ * sampling is rate limited: once the per-tick budget is exhausted,
+ * pages are left unprotected until the next profiling tick.
+ *
+ * build with -DMIR_HEATMAP=ON, otherwise all calls compile to nothing
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef MIR_HEATMAP
+
+/**
+ * @brief watch the object at `addr`, described by the metadata struct `type`
+ * arrays of `type` are supported, each element is accounted to the same fields
+ * @return 0 on success, -1 if `type` is unknown or too many objects are watched
+ */
+int heatmap_watch(const char *name, void *addr, size_t size, const char *type);
+
+/**
+ * @brief start sampling
+ * @param max_samples maximum number of samples per tick
+ * @param tick_us length of a tick, in microseconds (of CPU time), must be non-zero
+ * @return 0 on success, -1 if nothing is watched, sampling is already running or `tick_us` is 0
+ */
+int heatmap_start(unsigned max_samples, unsigned tick_us);
+void heatmap_stop(void);
+
+/**
+ * @brief write the hit counts per object and field as JSON
+ */
+void heatmap_dump(FILE *fh);
+
+#define HEATMAP_WATCH_DATA(name, type) \
+	heatmap_watch(#name, (void *)&(name), sizeof(name), #type)
+
+#else
+
+#define HEATMAP_WATCH_DATA(name, type) ((void)0)
+#define heatmap_start(max_samples, tick_us) ((void)0)
+#define heatmap_stop() ((void)0)
+#define heatmap_dump(fh) ((void)0)
+
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+/**
+ * @brief
+ * runtime description of the metadata structs,
+ * as emitted by the metadata tool in layout_generated.h
+ */
+
+struct meta_layout_field {
+	const char *name;
+	const char *type;
+	int offset;
+	int size;
+};
+
+struct meta_layout {
+	const char *name;
+	int size;
+	int num_fields;
+	/** sorted by offset, without padding */
+	const struct meta_layout_field *fields;
+};
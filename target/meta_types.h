@@ -5,3 +5,5 @@ BEGIN_META_STRUCT(sample_struct, 12)
 	META_STRUCT_FIELD(0, int, foo)
 	META_STRUCT_FIELD(11, unsigned char, bar)
 END_META_STRUCT(sample_struct)
+
+META_STRUCT_SOA(sample_struct, foo, bar)
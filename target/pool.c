@@ -0,0 +1,398 @@
+/**
+ * @copyright Copyright (c) 2024 Stefano Moioli <smxdev4@gmail.com>
+ *
+ * @brief
+ * size-class pools, see pool.h
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define POOL_CLASS_TABLE
+#include "pool.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/mman.h>
+#endif
+
+/** bytes requested from the heap (or the range) at once */
+#ifndef POOL_CHUNK_SIZE
+#define POOL_CHUNK_SIZE (64 * 1024)
+#endif
+
+/** objects moved between a thread and the shared lists at once */
+#ifndef POOL_BATCH
+#define POOL_BATCH 64
+#endif
+
+/** slot alignment. the objects themselves keep their exact size */
+#ifndef POOL_ALIGN
+#define POOL_ALIGN 8
+#endif
+
+#define POOL_CLASSES (POOL_NUM_CLASSES > 0 ? POOL_NUM_CLASSES : 1)
+
+#ifdef _MSC_VER
+#define POOL_TLS __declspec(thread)
+#else
+#define POOL_TLS __thread
+#endif
+
+struct pool_free_node {
+	struct pool_free_node *next;
+};
+
+struct pool_counters {
+	unsigned long allocs;
+	unsigned long frees;
+};
+
+/** shared state of a size class, protected by `lock` */
+struct pool_shared {
+	struct pool_free_node *free_list;
+	size_t free_count;
+	uint8_t *bump;
+	uint8_t *bump_end;
+	size_t chunks;
+	struct pool_counters counters;
+};
+
+struct pool_local {
+	struct pool_free_node *free_list;
+	size_t free_count;
+	/**
+	 * not yet merged into pool_shared.
+	 * written by the owning thread only, read by pool_dump
+	 */
+	struct pool_counters counters;
+};
+
+/** per-thread state, linked in `threads` from the first refill or free until the thread exits */
+struct pool_thread {
+	struct pool_local local[POOL_CLASSES];
+	struct pool_thread *prev;
+	struct pool_thread *next;
+	int registered;
+};
+
+static struct pool_shared shared[POOL_CLASSES];
+static POOL_TLS struct pool_thread self;
+static struct pool_thread *threads = NULL;
+static volatile long lock = 0;
+
+#ifdef _WIN32
+static DWORD exit_key = FLS_OUT_OF_INDEXES;
+#else
+static pthread_key_t exit_key;
+static int exit_key_ready = 0;
+#endif
+
+static uint8_t *range_next = NULL;
+static uint8_t *range_end = NULL;
+static void *range_begin = NULL;
+
+#ifdef _MSC_VER
+static void pool_lock(void){
+	while(InterlockedExchange(&lock, 1)){
+		while(lock) YieldProcessor();
+	}
+}
+
+static void pool_unlock(void){
+	InterlockedExchange(&lock, 0);
+}
+
+/** aligned longs are read and written at once, volatile keeps the accesses in place */
+static unsigned long load_relaxed(const unsigned long *p){
+	return *(const volatile unsigned long *)p;
+}
+
+static void store_relaxed(unsigned long *p, unsigned long v){
+	*(volatile unsigned long *)p = v;
+}
+#else
+static void pool_lock(void){
+	while(__atomic_exchange_n(&lock, 1, __ATOMIC_ACQUIRE)){
+		while(__atomic_load_n(&lock, __ATOMIC_RELAXED));
+	}
+}
+
+static void pool_unlock(void){
+	__atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+}
+
+static unsigned long load_relaxed(const unsigned long *p){
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void store_relaxed(unsigned long *p, unsigned long v){
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+#endif
+
+static size_t slot_size(int cls){
+	size_t size = pool_classes[cls].size;
+	if(size < sizeof(struct pool_free_node)) size = sizeof(struct pool_free_node);
+	return (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+}
+
+int pool_init(void *range, size_t range_size){
+	if(!range) return 0;
+	if(range_begin) return -1;
+#ifdef _WIN32
+	void *mem = VirtualAlloc(range, range_size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void *mem = mmap(range, range_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(mem == MAP_FAILED) mem = NULL;
+	// only a hint: refuse anything else
+	if(mem && mem != range){
+		munmap(mem, range_size);
+		mem = NULL;
+	}
+#endif
+	if(!mem){
+		fprintf(stderr, "pool: cannot map %zu bytes at %p\n", range_size, range);
+		return -1;
+	}
+	range_begin = mem;
+	range_next = (uint8_t *)mem;
+	range_end = range_next + range_size;
+	return 0;
+}
+
+static uint8_t *new_chunk(size_t size){
+	if(!range_begin) return malloc(size);
+	if((size_t)(range_end - range_next) < size) return NULL;
+	uint8_t *chunk = range_next;
+	range_next += size;
+	return chunk;
+}
+
+/** must be called with the lock held, by the thread owning `t` */
+static void merge_counters(struct pool_thread *t, int cls){
+	struct pool_counters *c = &t->local[cls].counters;
+	shared[cls].counters.allocs += c->allocs;
+	shared[cls].counters.frees += c->frees;
+	store_relaxed(&c->allocs, 0);
+	store_relaxed(&c->frees, 0);
+}
+
+static void count(unsigned long *counter, size_t n){
+	store_relaxed(counter, *counter + n);
+}
+
+/** gives all the objects and counts of the exiting thread back to the shared lists */
+#ifdef _WIN32
+static void WINAPI on_thread_exit(void *arg){
+#else
+static void on_thread_exit(void *arg){
+#endif
+	struct pool_thread *t = (struct pool_thread *)arg;
+	pool_lock();
+	for(int cls = 0; cls < POOL_NUM_CLASSES; cls++){
+		struct pool_local *l = &t->local[cls];
+		merge_counters(t, cls);
+		if(!l->free_list) continue;
+		struct pool_free_node *last = l->free_list;
+		while(last->next) last = last->next;
+		last->next = shared[cls].free_list;
+		shared[cls].free_list = l->free_list;
+		shared[cls].free_count += l->free_count;
+		l->free_list = NULL;
+		l->free_count = 0;
+	}
+	if(t->prev) t->prev->next = t->next;
+	else threads = t->next;
+	if(t->next) t->next->prev = t->prev;
+	t->registered = 0;
+	pool_unlock();
+}
+
+/** must be called with the lock held */
+static void register_thread(void){
+#ifdef _WIN32
+	if(exit_key == FLS_OUT_OF_INDEXES) exit_key = FlsAlloc(on_thread_exit);
+	if(exit_key != FLS_OUT_OF_INDEXES) FlsSetValue(exit_key, &self);
+#else
+	if(!exit_key_ready) exit_key_ready = pthread_key_create(&exit_key, on_thread_exit) == 0;
+	if(exit_key_ready) pthread_setspecific(exit_key, &self);
+#endif
+	self.prev = NULL;
+	self.next = threads;
+	if(threads) threads->prev = &self;
+	threads = &self;
+	self.registered = 1;
+}
+
+/**
+ * a thread that only frees objects allocated elsewhere must be registered too,
+ * or its free list would never be given back
+ */
+static void ensure_registered(void){
+	if(self.registered) return;
+	pool_lock();
+	register_thread();
+	pool_unlock();
+}
+
+/** moves up to POOL_BATCH objects to the thread's free list */
+static void refill(int cls){
+	struct pool_shared *s = &shared[cls];
+	struct pool_local *l = &self.local[cls];
+	size_t slot = slot_size(cls);
+
+	pool_lock();
+	if(!self.registered) register_thread();
+	merge_counters(&self, cls);
+	for(int i = 0; i < POOL_BATCH; i++){
+		struct pool_free_node *node = s->free_list;
+		if(node){
+			s->free_list = node->next;
+			--s->free_count;
+		} else {
+			if((size_t)(s->bump_end - s->bump) < slot){
+				size_t chunk_size = (slot > POOL_CHUNK_SIZE) ? slot : POOL_CHUNK_SIZE;
+				uint8_t *chunk = new_chunk(chunk_size);
+				if(!chunk) break;
+				s->bump = chunk;
+				s->bump_end = chunk + chunk_size;
+				++s->chunks;
+			}
+			node = (struct pool_free_node *)s->bump;
+			s->bump += slot;
+		}
+		node->next = l->free_list;
+		l->free_list = node;
+		++l->free_count;
+	}
+	pool_unlock();
+}
+
+/** gives POOL_BATCH objects back to the shared list, so other threads can reuse them */
+static void drain(int cls){
+	struct pool_local *l = &self.local[cls];
+	struct pool_free_node *first = l->free_list;
+	struct pool_free_node *last = first;
+	for(int i = 1; i < POOL_BATCH; i++) last = last->next;
+	l->free_list = last->next;
+	l->free_count -= POOL_BATCH;
+
+	pool_lock();
+	merge_counters(&self, cls);
+	last->next = shared[cls].free_list;
+	shared[cls].free_list = first;
+	shared[cls].free_count += POOL_BATCH;
+	pool_unlock();
+}
+
+void *pool_alloc(int cls){
+	struct pool_local *l = &self.local[cls];
+	if(!l->free_list){
+		refill(cls);
+		if(!l->free_list) return NULL;
+	}
+	struct pool_free_node *node = l->free_list;
+	l->free_list = node->next;
+	--l->free_count;
+	count(&l->counters.allocs, 1);
+	return node;
+}
+
+void pool_free(int cls, void *ptr){
+	if(!ptr) return;
+	ensure_registered();
+	struct pool_local *l = &self.local[cls];
+	struct pool_free_node *node = (struct pool_free_node *)ptr;
+	node->next = l->free_list;
+	l->free_list = node;
+	++l->free_count;
+	count(&l->counters.frees, 1);
+	if(l->free_count >= 2 * POOL_BATCH){
+		drain(cls);
+	}
+}
+
+size_t pool_alloc_n(int cls, void **out, size_t n){
+	struct pool_local *l = &self.local[cls];
+	size_t i = 0;
+	while(i < n){
+		if(!l->free_list){
+			refill(cls);
+			if(!l->free_list) break;
+		}
+		// whatever the thread has, without touching the counters per object
+		struct pool_free_node *node = l->free_list;
+		size_t taken = 0;
+		for(; i < n && node; i++, taken++){
+			out[i] = node;
+			node = node->next;
+		}
+		l->free_list = node;
+		l->free_count -= taken;
+		count(&l->counters.allocs, taken);
+	}
+	return i;
+}
+
+void pool_free_n(int cls, void **ptrs, size_t n){
+	ensure_registered();
+	struct pool_local *l = &self.local[cls];
+	size_t freed = 0;
+	for(size_t i = 0; i < n; i++){
+		struct pool_free_node *node = (struct pool_free_node *)ptrs[i];
+		if(!node) continue;
+		node->next = l->free_list;
+		l->free_list = node;
+		++freed;
+	}
+	l->free_count += freed;
+	count(&l->counters.frees, freed);
+	while(l->free_count >= 2 * POOL_BATCH){
+		drain(cls);
+	}
+}
+
+void pool_dump(FILE *fh){
+	pool_lock();
+	fprintf(fh, "{\n"
+		"  \"range\": { \"begin\": \"%p\", \"used\": %zu, \"size\": %zu },\n"
+		"  \"classes\": [",
+		range_begin,
+		(size_t)(range_next - (uint8_t *)range_begin),
+		(size_t)(range_end - (uint8_t *)range_begin));
+	for(int cls = 0; cls < POOL_NUM_CLASSES; cls++){
+		const struct pool_shared *s = &shared[cls];
+		// plus the counts that the live threads haven't merged yet
+		struct pool_counters c = s->counters;
+		for(struct pool_thread *t = threads; t; t = t->next){
+			c.allocs += load_relaxed(&t->local[cls].counters.allocs);
+			c.frees += load_relaxed(&t->local[cls].counters.frees);
+		}
+		size_t reserved = s->chunks * ((slot_size(cls) > POOL_CHUNK_SIZE) ? slot_size(cls) : POOL_CHUNK_SIZE);
+		unsigned long live = c.allocs - c.frees;
+		size_t used = live * pool_classes[cls].size;
+		fprintf(fh, "%s\n    {\n"
+			"      \"size\": %d,\n"
+			"      \"slot\": %zu,\n"
+			"      \"structs\": \"%s\",\n"
+			"      \"allocs\": %lu,\n"
+			"      \"frees\": %lu,\n"
+			"      \"live\": %lu,\n"
+			"      \"reserved_bytes\": %zu,\n"
+			"      \"unused_bytes\": %zu,\n"
+			"      \"shared_free\": %zu\n"
+			"    }",
+			(cls > 0) ? "," : "",
+			pool_classes[cls].size, slot_size(cls), pool_classes[cls].structs,
+			c.allocs, c.frees, live,
+			reserved, (reserved > used) ? reserved - used : 0,
+			s->free_count);
+	}
+	fprintf(fh, "\n  ]\n}\n");
+	pool_unlock();
+}
@@ -0,0 +1,80 @@
+#pragma once
+/**
+ * @brief
+ * size-class pools for metadata structs allocated by reimplemented code
+ *
+ * there is one size class per distinct struct size in the KB (pool_generated.h),
+ * so objects are exactly `size` bytes, with no header, like the original expects.
+ * each thread keeps its own free lists, refilled and drained in batches,
+ * and given back to the shared lists when the thread exits.
+ * chunks can optionally be taken from a fixed address range (pool_init).
+ *
+ * build with -DMIR_POOL=ON, otherwise pool_new_<name>() falls back to malloc
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct pool_class {
+	int size;
+	/** space separated names of the structs of this size */
+	const char *structs;
+};
+
+#ifdef MIR_POOL
+
+/**
+ * @brief carve all chunks from [range, range + range_size), instead of the heap.
+ * must be called before the first allocation
+ * @param range start of the range, or NULL for no constraint
+ * @return 0 on success, -1 if the range can't be mapped
+ */
+int pool_init(void *range, size_t range_size);
+
+/** @return NULL if the address range is exhausted */
+void *pool_alloc(int cls);
+void pool_free(int cls, void *ptr);
+
+/**
+ * @brief allocates `n` objects to `out`, taking the lock at most once per POOL_BATCH objects
+ * @return the number of objects allocated, less than `n` if the address range is exhausted
+ */
+size_t pool_alloc_n(int cls, void **out, size_t n);
+/** frees the `n` objects in `ptrs`. NULL entries are skipped */
+void pool_free_n(int cls, void **ptrs, size_t n);
+
+/**
+ * @brief write the allocation statistics per size class as JSON,
+ * including the counts of all the running threads
+ */
+void pool_dump(FILE *fh);
+
+#define POOL_ALLOC(cls, size) pool_alloc(cls)
+#define POOL_FREE(cls, ptr, size) pool_free(cls, ptr)
+#define POOL_ALLOC_N(cls, out, n, size) pool_alloc_n(cls, out, n)
+#define POOL_FREE_N(cls, ptrs, n, size) pool_free_n(cls, ptrs, n)
+
+#else
+
+static inline size_t pool_malloc_n(void **out, size_t n, size_t size){
+	for(size_t i = 0; i < n; i++){
+		if(!(out[i] = malloc(size))) return i;
+	}
+	return n;
+}
+
+static inline void pool_free_all(void **ptrs, size_t n){
+	for(size_t i = 0; i < n; i++) free(ptrs[i]);
+}
+
+#define POOL_ALLOC(cls, size) malloc(size)
+#define POOL_FREE(cls, ptr, size) free(ptr)
+#define POOL_ALLOC_N(cls, out, n, size) pool_malloc_n(out, n, size)
+#define POOL_FREE_N(cls, ptrs, n, size) pool_free_all(ptrs, n)
+#define pool_init(range, range_size) (0)
+#define pool_dump(fh) ((void)0)
+
+#endif
+
+#include "pool_generated.h"
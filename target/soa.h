@@ -0,0 +1,100 @@
+#pragma once
+/**
+ * @brief
+ * bulk copies between arrays of packed metadata structs (AoS)
+ * and plain arrays of one of their fields (SoA).
+ * used by the views generated in soa_generated.h (META_STRUCT_SOA)
+ *
+ * 4 and 8 byte fields are gathered with AVX2 and scattered with AVX-512,
+ * when the target is built for them; everything else is copied element-wise.
+ * without AVX2, the generated views gather with a single pass over the records instead
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+#define SOA_VECTOR_GATHER
+#endif
+
+/** number of records processed per field before moving to the next one */
+#ifndef SOA_BLOCK
+#define SOA_BLOCK 256
+#endif
+
+/**
+ * @brief copies the `size` bytes at `offset` of `count` records `stride` bytes apart, to `dst`
+ */
+static inline void soa_gather(void *dst, const void *src, size_t stride, size_t offset, size_t size, size_t count){
+	uint8_t *d = (uint8_t *)dst;
+	const uint8_t *s = (const uint8_t *)src + offset;
+	size_t i = 0;
+#ifdef __AVX2__
+	// the indices are relative to each block, so they can't overflow
+	if(size == 4 && stride <= INT32_MAX / 8){
+		const __m256i index = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int)stride));
+		for(; i + 8 <= count; i += 8){
+			__m256i v = _mm256_i32gather_epi32((const int *)(s + i * stride), index, 1);
+			_mm256_storeu_si256((__m256i *)(d + i * 4), v);
+		}
+	} else if(size == 8 && stride <= INT32_MAX / 4){
+		const __m128i index = _mm_mullo_epi32(
+			_mm_setr_epi32(0, 1, 2, 3),
+			_mm_set1_epi32((int)stride));
+		for(; i + 4 <= count; i += 4){
+			__m256i v = _mm256_i32gather_epi64((const long long *)(s + i * stride), index, 1);
+			_mm256_storeu_si256((__m256i *)(d + i * 8), v);
+		}
+	}
+#endif
+	switch(size){
+	case 1: for(; i < count; i++) d[i] = s[i * stride]; break;
+	case 2: for(; i < count; i++) INLINE_MEMCPY(d + i * 2, s + i * stride, 2); break;
+	case 4: for(; i < count; i++) INLINE_MEMCPY(d + i * 4, s + i * stride, 4); break;
+	case 8: for(; i < count; i++) INLINE_MEMCPY(d + i * 8, s + i * stride, 8); break;
+	default: for(; i < count; i++) INLINE_MEMCPY(d + i * size, s + i * stride, size); break;
+	}
+}
+
+/**
+ * @brief inverse of soa_gather: writes `count` values from `src` to the records at `dst`
+ * the other bytes of the records are left untouched
+ */
+static inline void soa_scatter(void *dst, const void *src, size_t stride, size_t offset, size_t size, size_t count){
+	uint8_t *d = (uint8_t *)dst + offset;
+	const uint8_t *s = (const uint8_t *)src;
+	size_t i = 0;
+#ifdef __AVX512F__
+	if(size == 4 && stride <= INT32_MAX / 16){
+		const __m512i index = _mm512_mullo_epi32(
+			_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+			_mm512_set1_epi32((int)stride));
+		for(; i + 16 <= count; i += 16){
+			__m512i v = _mm512_loadu_si512((const void *)(s + i * 4));
+			_mm512_i32scatter_epi32((void *)(d + i * stride), index, v, 1);
+		}
+	} else if(size == 8 && stride <= INT32_MAX / 8){
+		const __m256i index = _mm256_mullo_epi32(
+			_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+			_mm256_set1_epi32((int)stride));
+		for(; i + 8 <= count; i += 8){
+			__m512i v = _mm512_loadu_si512((const void *)(s + i * 8));
+			_mm512_i32scatter_epi64((void *)(d + i * stride), index, v, 1);
+		}
+	}
+#endif
+	switch(size){
+	case 1: for(; i < count; i++) d[i * stride] = s[i]; break;
+	case 2: for(; i < count; i++) INLINE_MEMCPY(d + i * stride, s + i * 2, 2); break;
+	case 4: for(; i < count; i++) INLINE_MEMCPY(d + i * stride, s + i * 4, 4); break;
+	case 8: for(; i < count; i++) INLINE_MEMCPY(d + i * stride, s + i * 8, 8); break;
+	default: for(; i < count; i++) INLINE_MEMCPY(d + i * stride, s + i * size, size); break;
+	}
+}
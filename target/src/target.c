@@ -1,10 +1,47 @@
 #include <stdio.h>
+#include <string.h>
+
+#include "capture.h"
+#include "pool.h"
+#include "mask_generated.h"
+#include "shadow_generated.h"
+
+int target_sample_func(int arg1){
+	CAPTURE_CALL(target_sample_func, arg1);
+	return arg1 * 2;
+}
 
 int main(int argc, char *argv[]){
+#ifdef MIR_CAPTURE
+	if(argc > 2 && !strcmp(argv[1], "-replay")){
+		return (capture_replay_corpus(argv[2], stdout) < 0) ? 1 : 0;
+	}
+	if(argc > 2 && !strcmp(argv[1], "-capture")){
+		capture_open(argv[2]);
+	}
+#endif
 	sample_struct sample = {
 		.foo = 1,
 		.bar = 2
 	};
 	printf("foo: %d, bar: %d\n", sample.foo, sample.bar);
+	printf("sample_func: %d\n", target_sample_func(sample.foo));
+
+	sample_struct *copy = pool_new_sample_struct();
+	if(copy){
+		*copy = sample;
+		printf("copy: foo: %d, bar: %d, equal: %d\n",
+			copy->foo, copy->bar, struct_equal_sample_struct(copy, &sample));
+		pool_delete_sample_struct(copy);
+	}
+
+	sample_struct_shadow shadow;
+	sample_struct_to_shadow(&shadow, &sample);
+	shadow.foo++;
+	sample_struct_from_shadow(&sample, &shadow);
+	printf("shadow: foo: %d, bar: %d\n", sample.foo, sample.bar);
+#ifdef MIR_CAPTURE
+	capture_close();
+#endif
 	return 0;
 }
@@ -1,3 +1,4 @@
 #pragma once
 DECLARE_TARGET_FUNCTION(0xdeadbeef, int, target_sample_func, int arg1);
 DECLARE_TARGET_DATA(0xbeefdead, int, target_sample_data);
+META_FUNCTION_CAPTURE(target_sample_func)
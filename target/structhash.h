@@ -0,0 +1,181 @@
+#pragma once
+/**
+ * @brief
+ * hash and equality of packed metadata structs that ignore the padding bytes,
+ * whose contents are unknown. used by the functions generated in mask_generated.h
+ *
+ * `mask` has one byte per struct byte, 0xff for the bytes of known fields and 0 for padding.
+ * the masked records are compared 32 or 16 bytes at a time with AVX2/SSE2, when available.
+ * records of up to 16 bytes get specialised bodies instead (see struct_small_load)
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#define STRUCT_HASH_K0 0x9e3779b97f4a7c15ULL
+#define STRUCT_HASH_K1 0xbf58476d1ce4e5b9ULL
+
+/** 64x64 -> 128 bit multiply, folded back to 64 bits */
+static inline uint64_t struct_hash_fold(uint64_t a, uint64_t b){
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)a * b;
+	return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+	uint64_t lo = a * b;
+	uint64_t hi = (a >> 32) * (b >> 32) + (((a & 0xffffffff) * (b >> 32)) >> 32) + ((a >> 32) * (b & 0xffffffff) >> 32);
+	return lo ^ hi;
+#endif
+}
+
+/**
+ * @brief loads the last `n` (< 16) bytes of a record, without reading past it.
+ * uses whole (possibly overlapping) loads instead of copying the bytes to a buffer,
+ * that would stall on store forwarding when read back
+ */
+static inline uint64_t struct_hash_load(const uint8_t *p, size_t n){
+	uint64_t w = 0;
+	if(n >= 8){
+		INLINE_MEMCPY(&w, p, 8);
+	} else if(n >= 4){
+		uint32_t lo, hi;
+		INLINE_MEMCPY(&lo, p, 4);
+		INLINE_MEMCPY(&hi, p + n - 4, 4);
+		w = lo | ((uint64_t)hi << ((n - 4) * 8));
+	} else if(n > 0){
+		w = p[0] | ((uint64_t)p[n / 2] << ((n / 2) * 8)) | ((uint64_t)p[n - 1] << ((n - 1) * 8));
+	}
+	return w;
+}
+
+/** one 16 byte block, with its key derived from the offset so that blocks can't be swapped */
+static inline uint64_t struct_hash_block(const uint8_t *p, const uint8_t *mask, size_t off, size_t n){
+	uint64_t w0, w1 = 0, m0, m1 = 0;
+	if(n >= 16){
+		INLINE_MEMCPY(&w0, p + off, 8);
+		INLINE_MEMCPY(&w1, p + off + 8, 8);
+		INLINE_MEMCPY(&m0, mask + off, 8);
+		INLINE_MEMCPY(&m1, mask + off + 8, 8);
+	} else {
+		w0 = struct_hash_load(p + off, n);
+		m0 = struct_hash_load(mask + off, n);
+		if(n > 8){
+			w1 = struct_hash_load(p + off + 8, n - 8);
+			m1 = struct_hash_load(mask + off + 8, n - 8);
+		}
+	}
+	return struct_hash_fold(
+		(w0 & m0) ^ (STRUCT_HASH_K0 + off),
+		(w1 & m1) ^ (STRUCT_HASH_K1 - off));
+}
+
+/**
+ * @brief
+ * records of at most 16 bytes are read as two (possibly overlapping) words:
+ * the first and the last 8 bytes, or the whole record in `lo` if it's shorter.
+ * the generated code masks them with constants, so there is no loop and no mask to load
+ */
+static inline void struct_small_load(const void *ptr, size_t size, uint64_t *lo, uint64_t *hi){
+	const uint8_t *p = (const uint8_t *)ptr;
+	if(size >= 8){
+		INLINE_MEMCPY(lo, p, 8);
+		INLINE_MEMCPY(hi, p + size - 8, 8);
+	} else {
+		*lo = struct_hash_load(p, size);
+		*hi = 0;
+	}
+}
+
+/** hash of the masked words of a small record (not comparable with struct_hash_masked) */
+static inline uint64_t struct_hash_small(uint64_t lo, uint64_t hi, size_t size){
+	return struct_hash_fold(
+		struct_hash_fold(lo ^ STRUCT_HASH_K0, hi ^ STRUCT_HASH_K1),
+		STRUCT_HASH_K0 ^ size);
+}
+
+/**
+ * @brief hash of the known bytes of a record.
+ * the blocks are independent of each other and summed, so they're computed in parallel
+ */
+static inline uint64_t struct_hash_masked(const void *ptr, const uint8_t *mask, size_t size){
+	const uint8_t *p = (const uint8_t *)ptr;
+	uint64_t h = size * STRUCT_HASH_K0;
+	size_t i = 0;
+	for(; i + 16 <= size; i += 16){
+		h += struct_hash_block(p, mask, i, 16);
+	}
+	if(i < size){
+		h += struct_hash_block(p, mask, i, size - i);
+	}
+
+	// murmur3 finalizer
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/** @return 1 if the known bytes of `a` and `b` are equal */
+static inline int struct_equal_masked(const void *a, const void *b, const uint8_t *mask, size_t size){
+	const uint8_t *pa = (const uint8_t *)a;
+	const uint8_t *pb = (const uint8_t *)b;
+	size_t i = 0;
+#ifdef __AVX2__
+	for(; i + 32 <= size; i += 32){
+		__m256i x = _mm256_and_si256(
+			_mm256_xor_si256(
+				_mm256_loadu_si256((const __m256i *)(pa + i)),
+				_mm256_loadu_si256((const __m256i *)(pb + i))),
+			_mm256_loadu_si256((const __m256i *)(mask + i)));
+		if(!_mm256_testz_si256(x, x)) return 0;
+	}
+#endif
+#ifdef __SSE2__
+	for(; i + 16 <= size; i += 16){
+		__m128i x = _mm_and_si128(
+			_mm_xor_si128(
+				_mm_loadu_si128((const __m128i *)(pa + i)),
+				_mm_loadu_si128((const __m128i *)(pb + i))),
+			_mm_loadu_si128((const __m128i *)(mask + i)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_setzero_si128())) != 0xffff) return 0;
+	}
+#endif
+	for(; i + 8 <= size; i += 8){
+		uint64_t wa, wb, m;
+		INLINE_MEMCPY(&wa, pa + i, 8);
+		INLINE_MEMCPY(&wb, pb + i, 8);
+		INLINE_MEMCPY(&m, mask + i, 8);
+		if((wa ^ wb) & m) return 0;
+	}
+	if(i < size){
+		uint64_t x = struct_hash_load(pa + i, size - i) ^ struct_hash_load(pb + i, size - i);
+		if(x & struct_hash_load(mask + i, size - i)) return 0;
+	}
+	return 1;
+}
+
+/** hashes `count` consecutive records */
+static inline void struct_hash_n_masked(uint64_t *out, const void *ptr, const uint8_t *mask, size_t size, size_t count){
+	const uint8_t *p = (const uint8_t *)ptr;
+	for(size_t i = 0; i < count; i++){
+		out[i] = struct_hash_masked(p + i * size, mask, size);
+	}
+}
+
+/** @return the index of the first of `count` consecutive records equal to `key`, or `count` */
+static inline size_t struct_find_masked(const void *key, const void *ptr, const uint8_t *mask, size_t size, size_t count){
+	const uint8_t *p = (const uint8_t *)ptr;
+	for(size_t i = 0; i < count; i++){
+#ifdef __GNUC__
+		__builtin_prefetch(p + (i + 4) * size);
+#endif
+		if(struct_equal_masked(key, p + i * size, mask, size)) return i;
+	}
+	return count;
+}